@@ -0,0 +1,244 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Applies a batch of replacements in a single forward sweep over the
+ * block list. Blocks that contain an edit are rebuilt into new, packed
+ * blocks and blocks between the edits are relinked as is, so the cost
+ * is proportional to the affected blocks rather than to the number of
+ * edits times the buffer size.
+ */
+
+#include "editbuffer.h"
+#include <errno.h>
+
+struct sweep {
+	TxtBuffer *buffer;
+	TxtBlock *tail;		/* Last block of the output */
+	TxtBlock *head;		/* First block of the output */
+	TxtBlock *cur;		/* Output block being filled, if any */
+};
+
+static int	_cmp(const void *, const void *);
+static void	_emit(struct sweep *, char *, size_t);
+static void	_keep(struct sweep *, TxtBlock *);
+
+/*
+ * Applies (n) non-overlapping (edits) to (buffer). Offsets refer to
+ * the buffer before any of the edits. The edits are sorted in place
+ * and the order of multiple insertions at the same offset is
+ * unspecified.
+ * The cursor is moved along with the text it was on.
+ *
+ * Returns 0 on success or -1 with errno set to EINVAL if the edits
+ * overlap or are out of range, or to ENOMEM if the memory budget ran
+ * out, see ebarena, in which case nothing is changed.
+ */
+int
+ebapply(TxtBuffer *buffer, TxtEdit *edits, size_t n)
+{
+	struct sweep sw;
+	TxtBlock *np, *next, *prev;
+	size_t i, pos, so, blen, lim, start, cursor, delta;
+	ssize_t *lines;
+	char *text, *p;
+
+	if (n == 0)
+		return 0;
+
+	qsort(edits, n, sizeof(TxtEdit), _cmp);
+	for (i = 0; i < n; i++) {
+		if (edits[i].off + edits[i].len > buffer->len ||
+		    (i > 0 && edits[i - 1].off + edits[i - 1].len >
+		    edits[i].off)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	/* Old blocks are freed as the sweep goes, so only growth counts */
+	for (i = 0, lim = 0, delta = 0; i < n; i++) {
+		lim += edits[i].len;
+		delta += edits[i].slen;
+	}
+	delta = delta > lim ? delta - lim : 0;
+	if (eb_reserve(buffer, delta / TXTBLOCK_MAXLEN + 4) == -1)
+		return -1;
+
+	cursor = buffer->offset;
+	for (i = n; i-- > 0; ) {
+		if (cursor <= edits[i].off)
+			continue;
+		if (cursor < edits[i].off + edits[i].len)
+			cursor = edits[i].off + edits[i].slen;
+		else
+			cursor = cursor - edits[i].len + edits[i].slen;
+	}
+
+	/* Line count changes, while the replaced text is still there */
+	if ((lines = reallocarray(NULL, n, sizeof(ssize_t))) == NULL)
+		err(1, "making space for edits");
+	for (i = 0; i < n; i++) {
+		lines[i] = -eb_nlines(buffer, edits[i].off, edits[i].len);
+		p = edits[i].s;
+		while ((p = memchr(p, '\n',
+		    edits[i].slen - (p - edits[i].s))) != NULL) {
+			lines[i]++;
+			p++;
+		}
+	}
+
+	/* Find the block containing the first edit */
+	ebseek(buffer, edits[0].off);
+	if ((np = buffer->root) == NULL && (np = buffer->last) != NULL)
+		so = buffer->root_offset - np->len;
+	else
+		so = buffer->root_offset;
+	prev = np != NULL ? np->prev : NULL;
+	start = so;
+
+	memset(&sw, 0, sizeof(sw));
+	sw.buffer = buffer;
+	sw.tail = prev;
+
+	pos = so;
+	i = 0;
+	for (; np != NULL; so += blen, np = next) {
+		next = np->next;
+		blen = np->len;
+		if (i == n && pos == so)
+			break;	/* Rest of the blocks are untouched */
+
+		if (pos == so && i < n && edits[i].off >= so + blen) {
+			_keep(&sw, np);
+			pos += blen;
+			continue;
+		}
+
+		while (pos < so + blen) {
+			if (i < n && edits[i].off == pos) {
+				_emit(&sw, edits[i].s, edits[i].slen);
+				pos += edits[i].len;
+				i++;
+				continue;
+			}
+			lim = so + blen;
+			if (i < n && edits[i].off < lim)
+				lim = edits[i].off;
+			text = EBTEXT(buffer, np);
+			_emit(&sw, &text[pos - so], lim - pos);
+			pos = lim;
+		}
+
+		eb_freeblock(buffer, np);
+	}
+
+	/* Insertions at the end of the buffer */
+	for (; i < n; i++)
+		_emit(&sw, edits[i].s, edits[i].slen);
+
+	/* Link the output between the untouched parts */
+	if (sw.tail != NULL) {
+		sw.tail->next = np;
+		EBRELINKED(sw.tail);
+	}
+	if (np != NULL) {
+		np->prev = sw.tail;
+		EBRELINKED(np);
+	} else
+		buffer->last = sw.tail;
+
+	for (i = 0; i < n; i++)
+		buffer->len = buffer->len - edits[i].len + edits[i].slen;
+
+	if (prev != NULL) {
+		buffer->root = prev;
+		buffer->root_offset = start - prev->len;
+	} else if ((buffer->root = sw.head ? sw.head : np) == NULL) {
+		buffer->last = NULL;
+		buffer->root_offset = 0;
+	} else
+		buffer->root_offset = 0;
+	ebseek(buffer, cursor);
+
+	for (i = 0, delta = 0; i < n; i++) {
+		eb_changed(buffer, edits[i].off + delta, edits[i].len,
+		    edits[i].slen, lines[i]);
+		delta = delta + edits[i].slen - edits[i].len;
+	}
+	free(lines);
+
+	return 0;
+}
+
+static int
+_cmp(const void *a, const void *b)
+{
+	const TxtEdit *x = a, *y = b;
+
+	/* Insertion goes before a replacement at the same offset */
+	if (x->off != y->off)
+		return x->off < y->off ? -1 : 1;
+	if (x->len != y->len)
+		return x->len < y->len ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Appends (len) bytes from (s) to the output, filling new blocks.
+ */
+static void
+_emit(struct sweep *sw, char *s, size_t len)
+{
+	TxtBlock *np;
+	size_t n;
+
+	while (len > 0) {
+		if (sw->cur == NULL || sw->cur->len == TXTBLOCK_MAXLEN) {
+			np = eb_allocblock(sw->buffer);
+			_keep(sw, np);
+			sw->cur = np;
+		}
+		n = TXTBLOCK_MAXLEN - sw->cur->len;
+		if (n > len)
+			n = len;
+		memcpy(&EBTEXT(sw->buffer, sw->cur)[sw->cur->len], s, n);
+		sw->cur->len += n;
+		EBMODIFIED(sw->cur);
+		s += n;
+		len -= n;
+	}
+}
+
+/*
+ * Appends block (np) to the output as is.
+ */
+static void
+_keep(struct sweep *sw, TxtBlock *np)
+{
+	np->prev = sw->tail;
+	np->next = NULL;
+	EBRELINKED(np);
+	if (sw->tail != NULL) {
+		sw->tail->next = np;
+		EBRELINKED(sw->tail);
+	}
+	if (sw->head == NULL)
+		sw->head = np;
+	sw->tail = np;
+	sw->cur = NULL;
+}
@@ -0,0 +1,236 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Process-wide arena for block text shared by all buffers. Text is
+ * allocated in chunks of TXTBLOCK_ALLOC bytes and freed chunks are kept
+ * in a pool for reuse by any buffer.
+ *
+ * An optional budget set with ebarena() limits the text of all buffers
+ * together. Edits reserve the chunks they may need up front with
+ * eb_reserve(), so they either fail as a whole with ENOMEM or succeed.
+ * Bringing back evicted text never fails but counts towards the budget,
+ * and exits like any other allocation if there is no memory left.
+ *
+ * Live chunks are kept in allocation order so that once the budget
+ * runs out, the reclaim hook set with ebonreclaim() can be offered the
+ * buffer owning the oldest text first, e.g. the oldest scrollback.
+ *
+ * Text shared by buffers, see ebdedup.c, has no owner and is passed
+ * around as a NULL buffer.
+ *
+ * The arena is not thread safe.
+ */
+
+#include "editbuffer.h"
+#include <stddef.h>
+#include <errno.h>
+
+#define EB_POOLMAX	64	/* Free chunks kept for reuse */
+
+struct txt_chunk {
+	TxtBuffer *owner;
+	struct txt_chunk *prev, *next;	/* Live chunks, oldest first */
+	char text[];
+};
+
+static struct {
+	size_t budget;		/* Zero for no limit */
+	size_t used;		/* Bytes in live chunks */
+	struct txt_chunk *head, *tail;
+	struct txt_chunk *pool;	/* Free chunks linked through next */
+	size_t npool;
+	int (*reclaim)(TxtBuffer *, size_t, void *);
+	void *reclaimarg;
+} arena;
+
+#define CHUNK(text)	\
+	((struct txt_chunk *) ((text) - offsetof(struct txt_chunk, text)))
+
+static TxtBuffer *_victim(TxtBuffer *);
+
+/*
+ * Limits the text of all buffers to (budget) bytes. Zero removes the
+ * limit.
+ */
+void
+ebarena(size_t budget)
+{
+	arena.budget = budget;
+}
+
+/*
+ * Returns the bytes of text allocated by all buffers.
+ */
+size_t
+ebarenaused(void)
+{
+	return arena.used;
+}
+
+/*
+ * Sets (fn) to be called with (arg) when an edit would exceed the
+ * budget. It is given the buffer with the oldest text other than the
+ * one being edited and the number of bytes needed. It should free text
+ * of that buffer, e.g. by deleting from its beginning or closing it,
+ * and return non-zero, or return zero to fail the edit.
+ */
+void
+ebonreclaim(int (*fn)(TxtBuffer *, size_t, void *), void *arg)
+{
+	arena.reclaim = fn;
+	arena.reclaimarg = arg;
+}
+
+/*
+ * Makes sure that (n) more chunks of text can be allocated for
+ * (buffer) within the budget, reclaiming text from other buffers if
+ * needed.
+ *
+ * Returns 0 on success or -1 with errno set to ENOMEM.
+ */
+int
+eb_reserve(TxtBuffer *buffer, size_t n)
+{
+	struct txt_chunk *c;
+	TxtBuffer *victim;
+	size_t need, used;
+
+	/* The resident cache frees text while allocating */
+	if (buffer->maxresident > 0 && n > buffer->maxresident + 1)
+		n = buffer->maxresident + 1;
+
+	need = n * TXTBLOCK_ALLOC;
+	if (arena.budget > 0 && need > arena.budget) {
+		errno = ENOMEM;
+		return -1;
+	}
+	while (arena.budget > 0 && arena.used + need > arena.budget) {
+		if (arena.reclaim == NULL ||
+		    (victim = _victim(buffer)) == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		used = arena.used;
+		if (!arena.reclaim(victim, arena.used + need - arena.budget,
+		    arena.reclaimarg) || arena.used >= used) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	for (; arena.npool < n; arena.npool++) {
+		if ((c = malloc(sizeof(*c) + TXTBLOCK_ALLOC)) == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		c->next = arena.pool;
+		arena.pool = c;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns a new chunk of text owned by (buffer).
+ */
+char *
+eb_alloctext(TxtBuffer *buffer)
+{
+	struct txt_chunk *c;
+
+	if ((c = arena.pool) != NULL) {
+		arena.pool = c->next;
+		arena.npool--;
+	} else if ((c = malloc(sizeof(*c) + TXTBLOCK_ALLOC)) == NULL)
+		err(1, "making space for text");
+
+	c->owner = buffer;
+	c->next = NULL;
+	if ((c->prev = arena.tail) != NULL)
+		arena.tail->next = c;
+	else
+		arena.head = c;
+	arena.tail = c;
+
+	arena.used += TXTBLOCK_ALLOC;
+	buffer->alloc += TXTBLOCK_ALLOC;
+
+	return c->text;
+}
+
+/*
+ * Frees chunk of (text) owned by (buffer).
+ */
+void
+eb_freetext(TxtBuffer *buffer, char *text)
+{
+	struct txt_chunk *c;
+
+	if (text == NULL)
+		return;
+	c = CHUNK(text);
+
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		arena.head = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	else
+		arena.tail = c->prev;
+
+	arena.used -= TXTBLOCK_ALLOC;
+	if (buffer != NULL)
+		buffer->alloc -= TXTBLOCK_ALLOC;
+
+	if (arena.npool < EB_POOLMAX) {
+		c->next = arena.pool;
+		arena.pool = c;
+		arena.npool++;
+	} else
+		free(c);
+}
+
+/*
+ * Hands chunk of (text) owned by (src) over to (dst).
+ */
+void
+eb_movetext(TxtBuffer *dst, TxtBuffer *src, char *text)
+{
+	CHUNK(text)->owner = dst;
+	if (src != NULL)
+		src->alloc -= TXTBLOCK_ALLOC;
+	if (dst != NULL)
+		dst->alloc += TXTBLOCK_ALLOC;
+}
+
+/*
+ * Returns the owner of the oldest chunk other than (buffer) and shared
+ * text.
+ */
+static TxtBuffer *
+_victim(TxtBuffer *buffer)
+{
+	struct txt_chunk *c;
+
+	for (c = arena.head; c != NULL; c = c->next)
+		if (c->owner != buffer && c->owner != NULL)
+			return c->owner;
+
+	return NULL;
+}
@@ -0,0 +1,151 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Allocation and freeing of blocks, shared by the modules that edit
+ * the block list.
+ */
+
+#include "editbuffer.h"
+
+/*
+ * Returns a new empty block linked after (parent), or the first block
+ * of an empty buffer if (parent) is NULL.
+ */
+TxtBlock *
+eb_newblock(TxtBuffer *buffer, TxtBlock *parent)
+{
+	TxtBlock *block;
+	
+	/*
+	 * First block of an empty buffer uses the inline storage which
+	 * is always free at this point.
+	 */
+	if (parent == NULL && buffer->last == NULL) {
+		block = &buffer->small;
+		memset(block, 0, sizeof(TxtBlock));
+		block->blockno = eb_blockno();
+		block->text = buffer->smalltext;
+		buffer->last = block;
+		buffer->blocks++;
+		buffer->shape++;
+		return block;
+	}
+
+	block = eb_allocblock(buffer);
+
+	block->prev = parent;
+	if (parent != NULL) {
+		block->next = parent->next;
+		if (block->next)
+			block->next->prev = block;
+		parent->next = block;
+	}
+
+	if (block->next == NULL)
+		buffer->last = block;
+
+	return block;
+}
+
+/*
+ * Returns a new empty block that is not linked anywhere yet. The text
+ * is allocated on first access.
+ */
+TxtBlock *
+eb_allocblock(TxtBuffer *buffer)
+{
+	TxtBlock *block;
+
+	if ((block = calloc(1, sizeof(TxtBlock))) == NULL)
+		err(1, "making space for new text");
+
+	block->blockno = eb_blockno();
+	block->len = 0;
+
+	buffer->alloc += sizeof(TxtBlock);
+	buffer->blocks++;
+	buffer->shape++;
+
+	return block;
+}
+
+/*
+ * Splits the block at (off) of (b) so that a block starts there, and
+ * returns that block, or NULL at the end of the buffer. The current
+ * block stays the one before (off).
+ */
+TxtBlock *
+eb_cut(TxtBuffer *b, size_t off)
+{
+	TxtBlock *np, *nb;
+	size_t k;
+	char *text;
+
+	ebseek(b, off);
+	if ((np = b->root) == NULL || (k = LOCAL_OFFSET(b)) == 0)
+		return np;
+
+	text = EBTEXT(b, np);
+	nb = eb_newblock(b, np);
+	memcpy(EBTEXT(b, nb), &text[k], np->len - k);
+	nb->len = np->len - k;
+	np->len = k;
+	EBMODIFIED(np);
+	EBMODIFIED(nb);
+
+	return nb;
+}
+
+/*
+ * Returns the first block of (buffer) or NULL if it has none.
+ */
+TxtBlock *
+eb_first(TxtBuffer *buffer)
+{
+	TxtBlock *np;
+
+	if ((np = buffer->root) == NULL)
+		np = buffer->last;
+	while (np != NULL && np->prev != NULL)
+		np = np->prev;
+
+	return np;
+}
+
+/*
+ * Frees (block) which has already been unlinked from the list.
+ */
+void
+eb_freeblock(TxtBuffer *buffer, TxtBlock *block)
+{
+	eb_release(buffer, block);
+	buffer->blocks--;
+	buffer->shape++;
+	if (block != &buffer->small) {
+		buffer->alloc -= sizeof(TxtBlock);
+		free(block);
+	}
+}
+
+size_t
+eb_blockno(void)
+{
+	static size_t blockno = 0;
+
+	return ++blockno;
+}
@@ -0,0 +1,328 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Resident block cache. When enabled with ebcompress() or ebswap(),
+ * only a limited number of most recently used blocks keep their text
+ * in memory. The text of the rest is compressed with lz.c and kept in
+ * memory, or written to the swap file. Text of a cold block is brought
+ * back on demand whenever it is accessed through EBTEXT(). Inline text,
+ * text mapped from a session image and shared text are never evicted.
+ *
+ * All resident blocks are kept in a doubly linked LRU list in most
+ * recently used order so that both touching and evicting are O(1).
+ */
+
+#include "editbuffer.h"
+
+static void _link(TxtBuffer *, TxtBlock *);
+static void _unlink(TxtBuffer *, TxtBlock *);
+static void _evict(TxtBuffer *, TxtBlock *);
+static void _fault(TxtBuffer *, TxtBlock *);
+
+/*
+ * Enables compression of all but (nblocks) most recently used blocks
+ * in (buffer). Zero disables compression.
+ */
+void
+ebcompress(TxtBuffer *buffer, size_t nblocks)
+{
+	buffer->zblocks = nblocks;
+	eb_recache(buffer);
+}
+
+/*
+ * Applies the current compression and swap settings to all blocks.
+ */
+void
+eb_recache(TxtBuffer *buffer)
+{
+	TxtBlock *np;
+	size_t n;
+
+	n = eb_swaplimit(buffer);
+	if (buffer->zblocks > 0 && (n == 0 || buffer->zblocks < n))
+		n = buffer->zblocks;
+	if (n > 0 && n < EB_MINRESIDENT)
+		n = EB_MINRESIDENT;
+
+	for (np = eb_first(buffer); np != NULL; np = np->next)
+		np->lprev = np->lnext = NULL;
+	buffer->mru = buffer->lru = NULL;
+	buffer->resident = 0;
+	buffer->maxresident = n;
+
+	/*
+	 * Bring every block back and evict again as we go, so that
+	 * the evicted text is stored the way it is now configured.
+	 */
+	for (np = eb_first(buffer); np != NULL; np = np->next) {
+		if (EBINLINE(buffer, np) || (np->flags & EBF_BORROWED))
+			continue;
+		if (np->text == NULL)
+			_fault(buffer, np);
+		if (n > 0) {
+			_link(buffer, np);
+			if (buffer->resident > buffer->maxresident)
+				_evict(buffer, buffer->lru);
+		}
+	}
+
+	if (buffer->root != NULL)
+		eb_text(buffer, buffer->root);
+}
+/*
+ * Returns the text of (block), decompressing it if necessary, and
+ * marks the block as the most recently used one. Use EBTEXT() which
+ * avoids the call for the most recently used block.
+ */
+char *
+eb_text(TxtBuffer *buffer, TxtBlock *block)
+{
+	if (EBINLINE(buffer, block) || (block->flags & EBF_BORROWED))
+		return block->text;
+
+	if (block->text == NULL)
+		_fault(buffer, block);
+	else if (buffer->maxresident > 0)
+		_unlink(buffer, block);
+
+	if (buffer->maxresident == 0) {
+		buffer->mru = block;
+		return block->text;
+	}
+
+	_link(buffer, block);
+	while (buffer->resident > buffer->maxresident)
+		_evict(buffer, buffer->lru);
+
+	return block->text;
+}
+
+/*
+ * Returns the text of (block) for modifying it. Text in a session
+ * image or shared text is copied to a regular allocation first. Use
+ * EBWTEXT().
+ */
+char *
+eb_wtext(TxtBuffer *buffer, TxtBlock *block)
+{
+	TxtShared *shared;
+	char *p;
+
+	if (block->flags & EBF_BORROWED) {
+		p = block->text;
+		shared = block->shared;
+		block->text = NULL;	/* Faults in a new allocation */
+		block->shared = NULL;
+		block->flags &= ~EBF_BORROWED;
+		memcpy(eb_text(buffer, block), p, block->len);
+		if (shared != NULL)
+			eb_unshare(shared);
+	}
+
+	return EBTEXT(buffer, block);
+}
+
+/*
+ * Releases all text storage of (block) which is about to be freed.
+ */
+void
+eb_release(TxtBuffer *buffer, TxtBlock *block)
+{
+	if (EBINLINE(buffer, block) || (block->flags & EBF_BORROWED)) {
+		if (block->shared != NULL)
+			eb_unshare(block->shared);
+		if (buffer->mru == block)
+			buffer->mru = NULL;
+		block->text = NULL;
+		block->shared = NULL;
+		block->flags &= ~EBF_BORROWED;
+		return;
+	}
+
+	if (buffer->maxresident > 0 && block->text != NULL)
+		_unlink(buffer, block);
+	else if (buffer->mru == block)
+		buffer->mru = NULL;
+
+	if (block->flags & EBF_SWAPPED)
+		eb_swapfree(buffer, block);
+	else
+		buffer->alloc -= block->zlen;
+
+	eb_freetext(buffer, block->text);
+	free(block->ztext);
+	block->text = block->ztext = NULL;
+	block->zlen = 0;
+	block->flags &= ~(EBF_SWAPPED | EBF_RAW);
+}
+
+/*
+ * Moves the text storage of (block), which has been unlinked from
+ * (src), to (dst). Swapped text is brought back first since the swap
+ * file belongs to (src).
+ */
+void
+eb_adopt(TxtBuffer *dst, TxtBuffer *src, TxtBlock *block)
+{
+	if (block->flags & EBF_SHARED) {
+		if (src->mru == block)
+			src->mru = NULL;
+		return;
+	}
+
+	if (block->text == NULL && (block->flags & EBF_SWAPPED))
+		_fault(src, block);
+	else if (src->maxresident > 0 && block->text != NULL)
+		_unlink(src, block);
+	if (src->mru == block)
+		src->mru = NULL;
+
+	if (block->text == NULL) {
+		src->alloc -= block->zlen;
+		dst->alloc += block->zlen;
+		return;
+	}
+
+	eb_movetext(dst, src, block->text);
+	if (dst->maxresident > 0) {
+		_link(dst, block);
+		while (dst->resident > dst->maxresident)
+			_evict(dst, dst->lru);
+	}
+}
+
+/*
+ * Takes the resident (block) out of the resident set for good, since
+ * its text is about to be shared or freed.
+ */
+void
+eb_forget(TxtBuffer *buffer, TxtBlock *block)
+{
+	if (buffer->maxresident > 0)
+		_unlink(buffer, block);
+	else if (buffer->mru == block)
+		buffer->mru = NULL;
+}
+
+static void
+_link(TxtBuffer *buffer, TxtBlock *block)
+{
+	block->lprev = NULL;
+	block->lnext = buffer->mru;
+	if (buffer->mru != NULL)
+		buffer->mru->lprev = block;
+	buffer->mru = block;
+	if (buffer->lru == NULL)
+		buffer->lru = block;
+	buffer->resident++;
+}
+
+static void
+_unlink(TxtBuffer *buffer, TxtBlock *block)
+{
+	if (block->lprev != NULL)
+		block->lprev->lnext = block->lnext;
+	else
+		buffer->mru = block->lnext;
+	if (block->lnext != NULL)
+		block->lnext->lprev = block->lprev;
+	else
+		buffer->lru = block->lprev;
+	block->lprev = block->lnext = NULL;
+	buffer->resident--;
+}
+
+/*
+ * Drops the text of (block) from the resident set, compressing it if
+ * compression is enabled and writing it to the swap file if swapping
+ * is enabled.
+ */
+static void
+_evict(TxtBuffer *buffer, TxtBlock *block)
+{
+	char z[LZ_BOUND(TXTBLOCK_MAXLEN)], *p;
+	size_t n, zn;
+
+	_unlink(buffer, block);
+
+	p = block->text;
+	n = block->len;
+	block->flags |= EBF_RAW;
+	if (buffer->zblocks > 0 && n > 0) {
+		zn = lz_compress(block->text, n, z, sizeof(z));
+		assert(zn > 0);
+		if (zn < n) {
+			p = z;
+			n = zn;
+			block->flags &= ~EBF_RAW;
+		}
+	}
+
+	if (eb_swaplimit(buffer) > 0) {
+		eb_swapout(buffer, block, p, n);
+	} else if (n > 0) {
+		if ((block->ztext = malloc(n)) == NULL)
+			err(1, "compressing text");
+		memcpy(block->ztext, p, n);
+		buffer->alloc += n;
+	}
+	block->zlen = n;
+
+	eb_freetext(buffer, block->text);
+	block->text = NULL;
+}
+
+/*
+ * Brings back the text of (block). The block is not yet linked to the
+ * resident set.
+ */
+static void
+_fault(TxtBuffer *buffer, TxtBlock *block)
+{
+	char z[TXTBLOCK_ALLOC], *p;
+	size_t n;
+
+	block->text = eb_alloctext(buffer);
+
+	if (block->flags & EBF_SWAPPED) {
+		p = (block->flags & EBF_RAW) ? block->text : z;
+		eb_swapin(buffer, block, p);
+	} else {
+		p = block->ztext;
+		buffer->alloc -= block->zlen;
+	}
+
+	/*
+	 * The length may have shrunk while evicted since deleting from
+	 * the end of a block does not touch its text.
+	 */
+	if (block->flags & EBF_RAW) {
+		if (p != block->text)
+			memcpy(block->text, p, block->zlen);
+	} else if (block->zlen > 0 &&
+	    ((n = lz_decompress(p, block->zlen, block->text,
+	    TXTBLOCK_ALLOC)) == (size_t) -1 || n < block->len))
+		errx(1, "corrupt compressed text in block %zu",
+		    block->blockno);
+
+	free(block->ztext);
+	block->ztext = NULL;
+	block->zlen = 0;
+	block->flags &= ~(EBF_SWAPPED | EBF_RAW);
+}
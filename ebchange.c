@@ -0,0 +1,239 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Change tracking for incremental redraw. Every edit bumps the buffer
+ * version and is reported to the optional change hook. Once somebody
+ * has asked for ebchanges(), edits are also kept in a short log where
+ * adjacent edits, such as typing or backspacing, coalesce into a
+ * single record.
+ */
+
+#include "editbuffer.h"
+
+#define EB_MAXCHANGES	64	/* Records kept in the change log */
+
+struct txt_changes {
+	size_t basever;		/* Log is complete after this version */
+	size_t sealed;		/* Version of the last query */
+	size_t first;		/* Oldest record in the ring */
+	size_t n;
+	struct {
+		size_t ver;	/* Version after the last merged edit */
+		TxtChange c;
+	} rec[EB_MAXCHANGES];
+};
+
+static int	_touches(TxtChange *, TxtChange *);
+static size_t	_merge(TxtChange *, size_t, TxtChange *);
+
+/*
+ * Sets (fn) to be called with (arg) after every edit of (buffer).
+ */
+void
+ebonchange(TxtBuffer *buffer, void (*fn)(TxtBuffer *, TxtChange *, void *),
+    void *arg)
+{
+	buffer->onchange = fn;
+	buffer->onchangearg = arg;
+}
+
+/*
+ * Stores up to (n) merged dirty ranges of (buffer) since version
+ * (since) to (out) in current offsets. Each range tells that (newlen)
+ * bytes at (off) replaced (oldlen) bytes, changing the number of lines
+ * by (lines). Ranges beyond (n) are merged into the last one. Ranges
+ * are exact when (since) is the version of an earlier query, otherwise
+ * they may be wider than the actual change.
+ *
+ * Returns the number of ranges stored or -1 if the changes since
+ * (since) are no longer known and everything should be considered
+ * dirty. The first call always starts the log.
+ */
+ssize_t
+ebchanges(TxtBuffer *buffer, size_t since, TxtChange *out, size_t n)
+{
+	TxtChanges *log;
+	TxtChange r[EB_MAXCHANGES];
+	size_t i, nr, last;
+
+	if ((log = buffer->changes) == NULL) {
+		if ((log = calloc(1, sizeof(TxtChanges))) == NULL)
+			err(1, "making space for changes");
+		log->basever = buffer->version;
+		buffer->changes = log;
+	}
+
+	if (since < log->basever || since > buffer->version)
+		return -1;
+
+	/* Keep the next query exact by not coalescing over this one */
+	log->sealed = buffer->version;
+
+	nr = 0;
+	for (i = 0; i < log->n; i++) {
+		last = (log->first + i) % EB_MAXCHANGES;
+		if (log->rec[last].ver > since)
+			nr = _merge(r, nr, &log->rec[last].c);
+	}
+
+	if (n == 0)
+		return 0;
+	for (; nr > n; nr--) {
+		r[nr - 2].oldlen = r[nr - 1].off + r[nr - 1].oldlen -
+		    r[nr - 2].off - r[nr - 2].newlen + r[nr - 2].oldlen;
+		r[nr - 2].newlen = r[nr - 1].off + r[nr - 1].newlen -
+		    r[nr - 2].off;
+		r[nr - 2].lines += r[nr - 1].lines;
+	}
+	memcpy(out, r, nr * sizeof(TxtChange));
+
+	return nr;
+}
+
+/*
+ * Records that (newlen) bytes at (off) replaced (oldlen) bytes, which
+ * changed the number of lines by (lines). Called by every edit after
+ * the buffer has been changed.
+ */
+void
+eb_changed(TxtBuffer *buffer, size_t off, size_t oldlen, size_t newlen,
+    ssize_t lines)
+{
+	TxtChanges *log;
+	TxtChange c;
+	size_t i;
+
+	buffer->version++;
+
+	c.off = off;
+	c.oldlen = oldlen;
+	c.newlen = newlen;
+	c.lines = lines;
+
+	if ((log = buffer->changes) != NULL) {
+		i = (log->first + log->n - 1) % EB_MAXCHANGES;
+		if (log->n > 0 && log->rec[i].ver > log->sealed &&
+		    _touches(&log->rec[i].c, &c)) {
+			_merge(&log->rec[i].c, 1, &c);
+			log->rec[i].ver = buffer->version;
+		} else {
+			if (log->n == EB_MAXCHANGES) {
+				log->basever = log->rec[log->first].ver;
+				log->first = (log->first + 1) % EB_MAXCHANGES;
+				log->n--;
+			}
+			i = (log->first + log->n) % EB_MAXCHANGES;
+			log->rec[i].ver = buffer->version;
+			log->rec[i].c = c;
+			log->n++;
+		}
+	}
+
+	if (buffer->columns != NULL)
+		eb_colchanged(buffer, off, oldlen, newlen, lines);
+	if (buffer->rows != NULL)
+		eb_rowchanged(buffer, off, oldlen, newlen);
+	if (buffer->syntax != NULL)
+		eb_syntaxchanged(buffer, off, oldlen, newlen);
+	if (buffer->words != NULL)
+		eb_wordchanged(buffer, off, oldlen, newlen);
+	if (buffer->load != NULL)
+		eb_loadchanged(buffer, off, oldlen, newlen);
+
+	if (buffer->onchange != NULL)
+		buffer->onchange(buffer, &c, buffer->onchangearg);
+}
+
+/*
+ * Returns the number of newlines in (len) bytes at (off).
+ */
+size_t
+eb_nlines(TxtBuffer *buffer, size_t off, size_t len)
+{
+	size_t n, k;
+	char *p, *end;
+
+	n = 0;
+	while (len > 0) {
+		ebseek(buffer, off);
+		if (buffer->root == NULL)
+			break;
+		k = buffer->root->len - LOCAL_OFFSET(buffer);
+		if (k > len)
+			k = len;
+		p = &EBTEXT(buffer, buffer->root)[LOCAL_OFFSET(buffer)];
+		end = p + k;
+		while ((p = memchr(p, '\n', end - p)) != NULL) {
+			n++;
+			p++;
+		}
+		off += k;
+		len -= k;
+	}
+
+	return n;
+}
+
+/*
+ * Returns non-zero if change (c) touches or is adjacent to range (r).
+ */
+static int
+_touches(TxtChange *r, TxtChange *c)
+{
+	return r->off <= c->off + c->oldlen && c->off <= r->off + r->newlen;
+}
+
+/*
+ * Applies change (c) to (nr) sorted, disjoint ranges in (r), merging
+ * the ranges it touches into one. Returns the new number of ranges.
+ */
+static size_t
+_merge(TxtChange *r, size_t nr, TxtChange *c)
+{
+	TxtChange m;
+	size_t i, j, k, end;
+
+	for (i = 0; i < nr && !_touches(&r[i], c) && r[i].off < c->off; i++)
+		;
+	for (j = i; j < nr && _touches(&r[j], c); j++)
+		;
+
+	m.off = c->off;
+	end = c->off + c->oldlen;
+	if (j > i) {
+		if (r[i].off < m.off)
+			m.off = r[i].off;
+		if (r[j - 1].off + r[j - 1].newlen > end)
+			end = r[j - 1].off + r[j - 1].newlen;
+	}
+	m.oldlen = end - m.off;
+	m.lines = c->lines;
+	for (k = i; k < j; k++) {
+		m.oldlen = m.oldlen - r[k].newlen + r[k].oldlen;
+		m.lines += r[k].lines;
+	}
+	m.newlen = end - m.off - c->oldlen + c->newlen;
+
+	memmove(&r[i + 1], &r[j], (nr - j) * sizeof(TxtChange));
+	nr = nr - (j - i) + 1;
+	r[i] = m;
+	for (k = i + 1; k < nr; k++)
+		r[k].off = r[k].off + c->newlen - c->oldlen;
+
+	return nr;
+}
@@ -0,0 +1,46 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "editbuffer.h"
+#include <sys/mman.h>
+
+/*
+ * Frees all blocks and resources of (buffer) and leaves it empty, as
+ * if it was just zero initialized.
+ */
+void
+ebclose(TxtBuffer *buffer)
+{
+	TxtBlock *np, *next;
+
+	ebloadcancel(buffer);
+	for (np = eb_first(buffer); np != NULL; np = next) {
+		next = np->next;
+		eb_freeblock(buffer, np);
+	}
+	buffer->root = buffer->last = NULL;
+
+	if (buffer->image != NULL)
+		munmap(buffer->image, buffer->imagelen);
+	ebswap(buffer, 0, NULL);
+	free(buffer->changes);
+	eb_colfree(buffer);
+	eb_rowfree(buffer);
+	eb_syntaxfree(buffer);
+	eb_wordfree(buffer);
+	memset(buffer, 0, sizeof(TxtBuffer));
+}
@@ -0,0 +1,473 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Display columns. Tabs advance to the next multiple of EB_TABSTOP,
+ * East Asian wide characters take two columns, combining characters
+ * none and everything else one. Invalid UTF-8 takes one column for each
+ * stray byte and one for a truncated sequence, like U+FFFD would.
+ *
+ * For a few recently used lines, the column is remembered at every
+ * EB_COLSTEP bytes or so, which are used as checkpoints for continuing
+ * the scan so that moving around a long line does not scan the line
+ * from its beginning every time.
+ *
+ * An edit within a line makes the checkpoints after it stale. When a
+ * scan reaches the first stale checkpoint, the difference between the
+ * new and the old column is applied to the following ones as long as
+ * their text is unchanged and they are not behind a tab that could
+ * absorb the difference. Only the text of the rest is scanned again.
+ */
+
+#define _GNU_SOURCE		/* memrchr */
+#include "editbuffer.h"
+
+#define EB_COLSTEP	256	/* Bytes between checkpoints */
+#define EB_COLLINES	4	/* Lines with checkpoints */
+
+#define CP_TAB		0x01	/* Tab since the previous checkpoint */
+#define CP_DIRTY	0x02	/* Edit since the previous checkpoint */
+
+struct txt_checkpoint {
+	size_t off;
+	size_t col;
+	int flags;
+};
+
+struct txt_columns {
+	size_t next;		/* Line to replace next */
+	struct txt_colline {
+		size_t bol;	/* Beginning of the line */
+		size_t end;	/* No newline before this offset */
+		struct txt_checkpoint *cp;
+		size_t ncp;	/* Zero if unused */
+		size_t nvalid;	/* Checkpoints before stale ones */
+		size_t maxcp;
+	} line[EB_COLLINES];
+};
+
+/*
+ * Ranges of East Asian wide and fullwidth characters, and of zero width
+ * characters.
+ */
+static const unsigned int wide[][2] = {
+	{ 0x1100, 0x115F }, { 0x2E80, 0x303E }, { 0x3041, 0x33FF },
+	{ 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+	{ 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+	{ 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 },
+	{ 0xFFE0, 0xFFE6 }, { 0x1F300, 0x1F64F }, { 0x1F900, 0x1F9FF },
+	{ 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD }
+};
+static const unsigned int zero[][2] = {
+	{ 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+	{ 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x200B, 0x200F },
+	{ 0x20D0, 0x20FF }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }
+};
+
+#define NELEMS(x)	(sizeof(x) / sizeof((x)[0]))
+
+enum { BYOFFSET, BYCOLUMN };
+
+static int	_inrange(const unsigned int (*)[2], size_t, unsigned int);
+static size_t	_bol(TxtBuffer *, size_t);
+static size_t	_line(TxtBuffer *, size_t);
+static void	_checkpoint(TxtColumns *, size_t, size_t, size_t, size_t *,
+		    int *);
+static size_t	_scan(TxtBuffer *, size_t, int, size_t, size_t *);
+
+/*
+ * Returns the display column of offset (pos) in buffer (b).
+ */
+size_t
+ebcolumn(TxtBuffer *b, size_t pos)
+{
+	size_t save, col;
+
+	if (pos > b->len)
+		pos = b->len;
+
+	save = ebtell(b);
+	_scan(b, _line(b, pos), BYOFFSET, pos, &col);
+	ebseek(b, save);
+
+	return col;
+}
+
+/*
+ * Returns the offset of the character at display column (col) of the
+ * line that has offset (pos) in buffer (b). Returns the start of a
+ * character that covers (col), such as a tab, or the end of the line
+ * if the line is shorter.
+ */
+size_t
+ebcolpos(TxtBuffer *b, size_t pos, size_t col)
+{
+	size_t save;
+
+	if (pos > b->len)
+		pos = b->len;
+
+	save = ebtell(b);
+	pos = _scan(b, _line(b, pos), BYCOLUMN, col, NULL);
+	ebseek(b, save);
+
+	return pos;
+}
+
+/*
+ * Adjusts the checkpoints after (newlen) bytes at (off) replaced
+ * (oldlen) bytes, which changed the number of lines by (lines).
+ */
+void
+eb_colchanged(TxtBuffer *b, size_t off, size_t oldlen, size_t newlen,
+    ssize_t lines)
+{
+	TxtColumns *cols = b->columns;
+	struct txt_checkpoint *cp;
+	size_t i, j, k, save;
+	int nl;
+
+	/* Whether the new text has a newline */
+	if (oldlen == 0 || newlen == 0)
+		nl = lines > 0;
+	else {
+		save = ebtell(b);
+		nl = eb_nlines(b, off, newlen) > 0;
+		ebseek(b, save);
+	}
+
+	for (i = 0; i < EB_COLLINES; i++) {
+		if (cols->line[i].ncp == 0)
+			continue;
+		if (off + oldlen < cols->line[i].bol) {
+			cols->line[i].bol += newlen - oldlen;
+			cols->line[i].end += newlen - oldlen;
+			for (k = 0; k < cols->line[i].ncp; k++)
+				cols->line[i].cp[k].off += newlen - oldlen;
+		} else if (off >= cols->line[i].bol) {
+			/*
+			 * A checkpoint right at the edit is stale too as
+			 * the new text may complete a truncated sequence.
+			 */
+			cp = cols->line[i].cp;
+			for (k = 1; k < cols->line[i].ncp; k++)
+				if (cp[k].off >= off)
+					break;
+			for (j = k; j < cols->line[i].ncp; j++)
+				if (cp[j].off >= off + oldlen)
+					break;
+			memmove(&cp[k], &cp[j], (cols->line[i].ncp - j) *
+			    sizeof(*cp));
+			cols->line[i].ncp -= j - k;
+			for (j = k; j < cols->line[i].ncp; j++)
+				cp[j].off += newlen - oldlen;
+			if (k < cols->line[i].ncp)
+				cp[k].flags |= CP_DIRTY;
+			if (cols->line[i].nvalid > k)
+				cols->line[i].nvalid = k;
+			if (cols->line[i].end >= off + oldlen && !nl)
+				cols->line[i].end += newlen - oldlen;
+			else if (cols->line[i].end > off)
+				cols->line[i].end = off;
+		} else
+			cols->line[i].ncp = 0;
+	}
+}
+
+/*
+ * Frees the checkpoints of (b).
+ */
+void
+eb_colfree(TxtBuffer *b)
+{
+	size_t i;
+
+	if (b->columns == NULL)
+		return;
+	for (i = 0; i < EB_COLLINES; i++)
+		free(b->columns->line[i].cp);
+	free(b->columns);
+	b->columns = NULL;
+}
+
+static int
+_inrange(const unsigned int (*r)[2], size_t n, unsigned int u)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (u < r[mid][0])
+			hi = mid;
+		else if (u > r[mid][1])
+			lo = mid + 1;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Returns the width of character (u) at column (col).
+ */
+size_t
+eb_colwidth(unsigned int u, size_t col)
+{
+	if (u == '\t')
+		return EB_TABSTOP - col % EB_TABSTOP;
+	if (u < 0x300)
+		return 1;
+	if (_inrange(zero, NELEMS(zero), u))
+		return 0;
+	if (_inrange(wide, NELEMS(wide), u))
+		return 2;
+	return 1;
+}
+
+/*
+ * Returns the beginning of the line that has offset (pos).
+ */
+static size_t
+_bol(TxtBuffer *b, size_t pos)
+{
+	TxtBlock *np;
+	size_t n;
+	char *p;
+
+	ebseek(b, pos);
+	if ((np = b->root) == NULL) {
+		if ((np = b->last) == NULL)
+			return 0;
+		n = np->len;
+	} else
+		n = LOCAL_OFFSET(b);
+	pos -= n;
+
+	for (;;) {
+		if ((p = memrchr(EBTEXT(b, np), '\n', n)) != NULL)
+			return pos + (p - np->text) + 1;
+		if ((np = np->prev) == NULL)
+			return 0;
+		n = np->len;
+		pos -= n;
+	}
+}
+
+/*
+ * Returns the index of the cached line that has offset (pos), setting
+ * up a new one if necessary.
+ */
+static size_t
+_line(TxtBuffer *b, size_t pos)
+{
+	TxtColumns *cols;
+	size_t i, bol;
+
+	if ((cols = b->columns) == NULL) {
+		if ((cols = calloc(1, sizeof(TxtColumns))) == NULL)
+			err(1, "making space for columns");
+		b->columns = cols;
+	}
+
+	for (i = 0; i < EB_COLLINES; i++)
+		if (cols->line[i].ncp > 0 && cols->line[i].bol <= pos &&
+		    pos <= cols->line[i].end)
+			return i;
+
+	bol = _bol(b, pos);
+	for (i = 0; i < EB_COLLINES; i++)
+		if (cols->line[i].ncp > 0 && cols->line[i].bol == bol)
+			return i;
+
+	i = cols->next;
+	cols->next = (i + 1) % EB_COLLINES;
+	if (cols->line[i].cp == NULL) {
+		cols->line[i].maxcp = 16;
+		if ((cols->line[i].cp = calloc(cols->line[i].maxcp,
+		    sizeof(struct txt_checkpoint))) == NULL)
+			err(1, "making space for columns");
+	}
+	cols->line[i].bol = cols->line[i].end = bol;
+	cols->line[i].cp[0].off = bol;
+	cols->line[i].cp[0].col = 0;
+	cols->line[i].cp[0].flags = 0;
+	cols->line[i].ncp = cols->line[i].nvalid = 1;
+
+	return i;
+}
+
+/*
+ * Called at every character at offset (o) and column (col) while
+ * scanning cached line (i). Validates the stale checkpoint at (o), if
+ * any, or adds a new one. (next) is the index of the checkpoint after
+ * the previous character and (tab) tells if there was a tab since the
+ * checkpoint before it.
+ */
+static void
+_checkpoint(TxtColumns *cols, size_t i, size_t o, size_t col, size_t *next,
+    int *tab)
+{
+	struct txt_colline *L = &cols->line[i];
+	struct txt_checkpoint *cp;
+	size_t k, shift;
+
+	k = *next;
+	if (k < L->ncp && L->cp[k].off == o) {
+		if (k == L->nvalid) {
+			cp = L->cp;
+			shift = col - cp[k].col;
+			cp[k].col = col;
+			cp[k].flags = *tab ? CP_TAB : 0;
+			for (k++; k < L->ncp; k++) {
+				if (cp[k].flags & CP_DIRTY)
+					break;
+				if ((cp[k].flags & CP_TAB) &&
+				    shift % EB_TABSTOP != 0) {
+					/* Not in step with the rest anymore */
+					cp[k].flags |= CP_DIRTY;
+					break;
+				}
+				cp[k].col += shift;
+			}
+			L->nvalid = k;
+		}
+		(*next)++;
+		*tab = 0;
+		return;
+	}
+
+	if (k != L->nvalid || o < L->cp[k - 1].off + EB_COLSTEP)
+		return;
+
+	if (L->ncp == L->maxcp) {
+		L->maxcp *= 2;
+		if ((cp = reallocarray(L->cp, L->maxcp, sizeof(*cp))) == NULL)
+			err(1, "making space for columns");
+		L->cp = cp;
+	}
+	cp = &L->cp[k];
+	memmove(cp + 1, cp, (L->ncp - k) * sizeof(*cp));
+	cp->off = o;
+	cp->col = col;
+	cp->flags = *tab ? CP_TAB : 0;
+	L->ncp++;
+	L->nvalid++;
+	(*next)++;
+	*tab = 0;
+}
+
+/*
+ * Scans cached line (i) from the nearest checkpoint until offset (to)
+ * or column (to), adding checkpoints on the way. Returns the offset
+ * where the scan stopped and stores the column there to (colp).
+ */
+static size_t
+_scan(TxtBuffer *b, size_t i, int by, size_t to, size_t *colp)
+{
+	TxtColumns *cols = b->columns;
+	struct txt_checkpoint *cp;
+	TxtBlock *np;
+	size_t lo, hi, mid, o, col, w, start, k, next;
+	unsigned int u, need;
+	int tab;
+	unsigned char ch;
+	char *text;
+
+	/* Last checkpoint before the target */
+	cp = cols->line[i].cp;
+	lo = 0;
+	hi = cols->line[i].nvalid;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (by == BYOFFSET ? cp[mid].off <= to : cp[mid].col < to)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	o = cp[lo].off;
+	col = cp[lo].col;
+
+	ebseek(b, o);
+	np = b->root;		/* NULL at the end of the buffer */
+	k = np != NULL ? LOCAL_OFFSET(b) : 0;
+
+	u = need = 0;
+	start = o;
+	next = lo + 1;
+	tab = 0;
+	for (; np != NULL; np = np->next, k = 0) {
+		text = EBTEXT(b, np);
+		for (; k < np->len; k++, o++) {
+			ch = text[k];
+			if (need > 0 && (ch & 0xC0) == 0x80) {
+				if (by == BYOFFSET && o >= to)
+					goto done;
+				u = (u << 6) | (ch & 0x3F);
+				if (--need > 0)
+					continue;
+				w = eb_colwidth(u, col);
+			} else {
+				if (need > 0) {
+					/* Truncated sequence */
+					need = 0;
+					if (by == BYCOLUMN && col + 1 > to) {
+						o = start;
+						goto done;
+					}
+					col++;
+				}
+				if (by == BYOFFSET && o >= to)
+					goto done;
+				if (ch == '\n')
+					goto done;
+
+				if (o > cols->line[i].end)
+					cols->line[i].end = o;
+				_checkpoint(cols, i, o, col, &next, &tab);
+				if (ch == '\t')
+					tab = 1;
+				start = o;
+				if (ch >= 0xC2 && ch < 0xF5) {
+					need = ch >= 0xF0 ? 3 : ch >= 0xE0 ? 2 : 1;
+					u = ch & (0x3F >> need);
+					continue;
+				}
+				w = eb_colwidth(ch < 0x80 ? ch : 0xFFFD, col);
+			}
+			if (by == BYCOLUMN && col + w > to) {
+				o = start;
+				goto done;
+			}
+			col += w;
+		}
+	}
+
+	if (need > 0) {
+		if (by == BYCOLUMN && col + 1 > to)
+			o = start;
+		else
+			col++;
+	}
+done:
+	if (o > cols->line[i].end)
+		cols->line[i].end = o;
+	if (colp != NULL)
+		*colp = col;
+	return o;
+}
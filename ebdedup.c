@@ -0,0 +1,230 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Deduplication of block text. Once a block of a buffer with ebdedup()
+ * enabled is full and text is appended past it, its text is hashed and
+ * looked up among the texts shared so far, by any buffer. An identical
+ * text is shared by reference instead and the block frees its own, so
+ * text that repeats at the same offset within blocks, such as the same
+ * file loaded into several buffers, is stored only once. A shared text
+ * is copied before it is modified, see EBWTEXT(), and freed with the
+ * last block referring to it.
+ *
+ * Shared text stays in memory like text mapped from a session image,
+ * so it is not compressed or swapped. It counts towards the budget of
+ * the arena but is never offered to the reclaim hook.
+ *
+ * Sharing is not thread safe, like the arena.
+ */
+
+#include "editbuffer.h"
+#include <stdint.h>
+
+struct txt_shared {
+	TxtShared *next;	/* Hash chain */
+	uint64_t hash;
+	size_t len;
+	size_t refs;		/* Blocks referring to the text */
+	char *text;		/* Chunk without an owner, see ebarena */
+};
+
+static struct {
+	TxtShared **table;
+	size_t size;		/* Hash chains, a power of two */
+	size_t n;		/* Texts shared */
+	TxtDedup stats;
+} dedup;
+
+static uint64_t	 _hash(const char *, size_t);
+static TxtShared	*_lookup(uint64_t, const char *, size_t);
+static void	 _insert(TxtShared *);
+static void	 _grow(void);
+
+/*
+ * Enables sharing the text of full blocks of (buffer) with identical
+ * blocks of any buffer, or disables it if (enable) is zero. Enabling
+ * shares the full blocks already in (buffer). Disabling keeps the text
+ * shared so far.
+ */
+void
+ebdedup(TxtBuffer *buffer, int enable)
+{
+	TxtBlock *np;
+	size_t save;
+
+	if ((buffer->dedup = enable) == 0)
+		return;
+
+	save = ebtell(buffer);
+	ebseek(buffer, 0);
+	for (np = buffer->root; np != NULL; np = np->next)
+		eb_dedup(buffer, np);
+	ebseek(buffer, save);
+}
+
+/*
+ * Stores what sharing has saved so far, for all buffers together, to
+ * (stats).
+ */
+void
+ebdedupstats(TxtDedup *stats)
+{
+	*stats = dedup.stats;
+	stats->saved = (stats->refs - stats->shared) * TXTBLOCK_ALLOC;
+}
+
+/*
+ * Shares the text of (block) of (buffer) if the block is full.
+ */
+void
+eb_dedup(TxtBuffer *buffer, TxtBlock *block)
+{
+	TxtShared *s;
+	uint64_t h;
+	char *text;
+
+	if (block->len != TXTBLOCK_MAXLEN || EBINLINE(buffer, block) ||
+	    (block->flags & EBF_BORROWED))
+		return;
+
+	text = EBTEXT(buffer, block);
+	h = _hash(text, block->len);
+	eb_forget(buffer, block);
+	if ((s = _lookup(h, text, block->len)) != NULL) {
+		eb_freetext(buffer, text);
+		dedup.stats.hits++;
+	} else {
+		if ((s = calloc(1, sizeof(TxtShared))) == NULL)
+			err(1, "making space for shared text");
+		s->hash = h;
+		s->len = block->len;
+		s->text = text;
+		eb_movetext(NULL, buffer, text);
+		_insert(s);
+	}
+
+	s->refs++;
+	dedup.stats.refs++;
+	block->text = s->text;
+	block->shared = s;
+	block->flags |= EBF_SHARED;
+}
+
+/*
+ * Drops a reference to shared text (s), freeing it with the last one.
+ */
+void
+eb_unshare(TxtShared *s)
+{
+	TxtShared **pp;
+
+	dedup.stats.refs--;
+	if (--s->refs > 0)
+		return;
+
+	for (pp = &dedup.table[s->hash & (dedup.size - 1)]; *pp != s;
+	    pp = &(*pp)->next)
+		;
+	*pp = s->next;
+	dedup.n--;
+	dedup.stats.shared--;
+
+	eb_freetext(NULL, s->text);
+	free(s);
+}
+
+/*
+ * Hashes (len) bytes of (s) a word at a time.
+ */
+static uint64_t
+_hash(const char *s, size_t len)
+{
+	uint64_t h, w;
+	size_t i;
+
+	h = len;
+	for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, &s[i], sizeof(w));
+		h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	for (; i < len; i++)
+		h = (h ^ (unsigned char) s[i]) * 0x100000001B3ULL;
+
+	return h ^ (h >> 32);
+}
+
+/*
+ * Returns the shared text identical to (len) bytes of (text) with hash
+ * (h), or NULL if there is none.
+ */
+static TxtShared *
+_lookup(uint64_t h, const char *text, size_t len)
+{
+	TxtShared *s;
+
+	if (dedup.size == 0)
+		return NULL;
+
+	for (s = dedup.table[h & (dedup.size - 1)]; s != NULL; s = s->next)
+		if (s->hash == h && s->len == len &&
+		    memcmp(s->text, text, len) == 0)
+			return s;
+
+	return NULL;
+}
+
+static void
+_insert(TxtShared *s)
+{
+	TxtShared **pp;
+
+	if (dedup.n >= dedup.size)
+		_grow();
+
+	pp = &dedup.table[s->hash & (dedup.size - 1)];
+	s->next = *pp;
+	*pp = s;
+	dedup.n++;
+	dedup.stats.shared++;
+}
+
+/*
+ * Doubles the number of hash chains.
+ */
+static void
+_grow(void)
+{
+	TxtShared **table, *s, *next;
+	size_t i, size;
+
+	size = dedup.size > 0 ? dedup.size * 2 : 256;
+	if ((table = calloc(size, sizeof(TxtShared *))) == NULL)
+		err(1, "making space for shared text");
+
+	for (i = 0; i < dedup.size; i++)
+		for (s = dedup.table[i]; s != NULL; s = next) {
+			next = s->next;
+			s->next = table[s->hash & (size - 1)];
+			table[s->hash & (size - 1)] = s;
+		}
+
+	free(dedup.table);
+	dedup.table = table;
+	dedup.size = size;
+}
@@ -21,18 +21,37 @@
 static void _backtrack(TxtBuffer *buffer);
 static TxtBlock* delempty(TxtBuffer *buffer, TxtBlock *block);
 
-void
+/*
+ * Deletes (len) bytes before the cursor of (buffer).
+ *
+ * Returns 0 on success or -1 with errno set to ENOMEM if the memory
+ * budget ran out, see ebarena, in which case nothing is changed.
+ */
+int
 ebdel(TxtBuffer *buffer, size_t len)
 {
-	ssize_t begin, end;
-	char *dst, *src;
+	ssize_t begin, end, from;
+	size_t lines;
+	char *dst, *src, *text;
 
 	begin = buffer->offset;
 	if (begin > buffer->len)
 		begin = buffer->len;
 
+	/* Only the first block may be changed inside, and copied for it */
+	ebseek(buffer, begin);
+	if (len > 0 && buffer->root != NULL && LOCAL_OFFSET(buffer) > 0 &&
+	    LOCAL_OFFSET(buffer) < buffer->root->len &&
+	    (buffer->root->flags & EBF_BORROWED) &&
+	    eb_reserve(buffer, 1) == -1)
+		return -1;
+
 	end = buffer->offset - len;
 
+	from = end < 0 ? 0 : end;
+	lines = eb_nlines(buffer, from, begin - from);
+	from = begin;
+
 	ebseek(buffer, begin);
 	_backtrack(buffer);
 
@@ -43,6 +62,7 @@ ebdel(TxtBuffer *buffer, size_t len)
 		if (buffer->root && LOCAL_OFFSET(buffer) == 0) {
 			if (buffer->root->prev) {
 				buffer->root->prev->len--;
+				EBMODIFIED(buffer->root->prev);
 				buffer->len--;
 				begin--;
 				buffer->offset--;
@@ -56,13 +76,15 @@ ebdel(TxtBuffer *buffer, size_t len)
 		else if (buffer->root && buffer->root->len) {
 			if (begin - buffer->root_offset < buffer->root->len &&
 			    LOCAL_OFFSET(buffer) > 0) {
-				dst = &(buffer->root->text[LOCAL_OFFSET(buffer) - 1]);
-				src = &(buffer->root->text[LOCAL_OFFSET(buffer)]);
+				text = EBWTEXT(buffer, buffer->root);
+				dst = &(text[LOCAL_OFFSET(buffer) - 1]);
+				src = &(text[LOCAL_OFFSET(buffer)]);
 				memmove(dst, src, 
 				    (buffer->root->len - LOCAL_OFFSET(buffer)) *
 				    sizeof(char));
 			}
 			buffer->root->len--;
+			EBMODIFIED(buffer->root);
 			begin--;
 			buffer->len--;
 			buffer->offset--;
@@ -76,6 +98,12 @@ ebdel(TxtBuffer *buffer, size_t len)
 			}
 		}
 	}
+
+	if (from != buffer->offset)
+		eb_changed(buffer, buffer->offset, from - buffer->offset, 0,
+		    -(ssize_t) lines);
+
+	return 0;
 }
 
 static TxtBlock*
@@ -96,9 +124,7 @@ delempty(TxtBuffer *buffer, TxtBlock *block)
 
 		block = tmp->prev;	/* This can become new root */
 
-		buffer->alloc -= (TXTBLOCK_ALLOC + sizeof(TxtBlock));
-		buffer->blocks--;
-		free(tmp);
+		eb_freeblock(buffer, tmp);
 		tmp = NULL;
 	}
 
@@ -0,0 +1,391 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Differences between two buffers. Equal text is compared a block span
+ * at a time, and spans that share their text, see ebdedup.c, are equal
+ * without looking at them. After a difference the two buffers are
+ * resynchronized by looking for the closest text they have in common
+ * with a rolling hash. The search starts small and grows only while
+ * nothing is found, so the cost is proportional to the size of the
+ * changed regions and not to the size of the buffers.
+ *
+ * The result is a correct edit script but not necessarily the shortest
+ * one, since resynchronizing takes the closest common text and not the
+ * longest common subsequence.
+ */
+
+#include "editbuffer.h"
+#include <stdint.h>
+
+#define EB_DIFFWIN	32	/* Bytes that must match to resynchronize */
+#define EB_DIFFSTEP	16	/* Distance of hashed windows in the first */
+#define EB_DIFFSCAN	4096	/* Bytes searched at first */
+
+#define HASHMUL		0x100000001B3ULL
+#define SLOT(h, size)	(((h) ^ ((h) >> 29)) & ((size) - 1))
+
+struct diff {
+	TxtBuffer *a, *b;
+	size_t aend, bend;	/* Common suffix begins */
+	TxtHunk *out;
+	size_t n;
+	size_t nout;
+	char *abuf, *bbuf;	/* Text searched for resynchronizing */
+	size_t asize, bsize;
+};
+
+struct anchor {
+	uint64_t hash;
+	size_t off;		/* Offset plus one, zero if not used */
+};
+
+static size_t	 _match(TxtBuffer *, size_t, TxtBuffer *, size_t, size_t);
+static size_t	 _rmatch(TxtBuffer *, size_t, TxtBuffer *, size_t, size_t);
+static size_t	 _equal(const char *, const char *, size_t);
+static size_t	 _requal(const char *, const char *, size_t);
+static void	 _sync(struct diff *, size_t, size_t, size_t *, size_t *);
+static int	 _find(const char *, size_t, const char *, size_t, size_t *,
+		    size_t *);
+static char	*_copy(TxtBuffer *, size_t, size_t, char **, size_t *);
+static uint64_t	 _hash(const char *);
+static void	 _hunk(struct diff *, size_t, size_t, size_t, size_t);
+
+/*
+ * Stores up to (n) hunks that turn the text of (a) into the text of
+ * (b) to (out), in order. Hunks beyond (n) are merged into the last
+ * one. Either buffer may be a snapshot, e.g. restored with ebrestore().
+ * The cursors stay where they were.
+ *
+ * Returns the number of hunks stored, which is 0 if the buffers have
+ * the same text.
+ */
+ssize_t
+ebdiff(TxtBuffer *a, TxtBuffer *b, TxtHunk *out, size_t n)
+{
+	struct diff d;
+	size_t acursor, bcursor, ai, bj, na, nb, k;
+
+	if (a == b || n == 0)
+		return 0;
+
+	memset(&d, 0, sizeof(d));
+	d.a = a;
+	d.b = b;
+	d.out = out;
+	d.n = n;
+	acursor = a->offset;
+	bcursor = b->offset;
+
+	/* The common suffix bounds everything else */
+	k = _rmatch(a, a->len, b, b->len, a->len < b->len ? a->len : b->len);
+	d.aend = a->len - k;
+	d.bend = b->len - k;
+
+	ai = bj = 0;
+	for (;;) {
+		k = d.aend - ai < d.bend - bj ? d.aend - ai : d.bend - bj;
+		k = _match(a, ai, b, bj, k);
+		ai += k;
+		bj += k;
+		if (ai == d.aend && bj == d.bend)
+			break;
+
+		_sync(&d, ai, bj, &na, &nb);
+		_hunk(&d, ai, na - ai, bj, nb - bj);
+		ai = na;
+		bj = nb;
+	}
+
+	free(d.abuf);
+	free(d.bbuf);
+	ebseek(a, acursor);
+	ebseek(b, bcursor);
+
+	return d.nout;
+}
+
+/*
+ * Returns how many of at most (max) bytes at (ai) of (a) and at (bj)
+ * of (b) are equal.
+ */
+static size_t
+_match(TxtBuffer *a, size_t ai, TxtBuffer *b, size_t bj, size_t max)
+{
+	size_t k, m, na, nb, j;
+	char *p, *q;
+
+	for (k = 0; k < max; k += m) {
+		if ((na = ebspan(a, ai + k, &p)) == 0 ||
+		    (nb = ebspan(b, bj + k, &q)) == 0)
+			break;
+		m = na < nb ? na : nb;
+		if (m > max - k)
+			m = max - k;
+
+		/* Shared text */
+		if (p == q)
+			continue;
+
+		if ((j = _equal(p, q, m)) < m)
+			return k + j;
+	}
+
+	return k;
+}
+
+/*
+ * Returns how many of at most (max) bytes before (aend) of (a) and
+ * before (bend) of (b) are equal.
+ */
+static size_t
+_rmatch(TxtBuffer *a, size_t aend, TxtBuffer *b, size_t bend, size_t max)
+{
+	size_t k, m, na, nb, j;
+	char *p, *q;
+
+	for (k = 0; k < max; k += m) {
+		if ((na = ebrspan(a, aend - k, &p)) == 0 ||
+		    (nb = ebrspan(b, bend - k, &q)) == 0)
+			break;
+		m = na < nb ? na : nb;
+		if (m > max - k)
+			m = max - k;
+		p += na - m;
+		q += nb - m;
+
+		if (p == q)
+			continue;
+
+		if ((j = _requal(p, q, m)) < m)
+			return k + j;
+	}
+
+	return k;
+}
+
+/*
+ * Returns the length of the common prefix of (n) bytes of (p) and (q).
+ */
+static size_t
+_equal(const char *p, const char *q, size_t n)
+{
+	uint64_t x, y;
+	size_t i;
+
+	if (memcmp(p, q, n) == 0)
+		return n;
+
+	for (i = 0; i + sizeof(x) <= n; i += sizeof(x)) {
+		memcpy(&x, &p[i], sizeof(x));
+		memcpy(&y, &q[i], sizeof(y));
+		if (x != y)
+			break;
+	}
+	while (i < n && p[i] == q[i])
+		i++;
+
+	return i;
+}
+
+/*
+ * Returns the length of the common suffix of (n) bytes of (p) and (q).
+ */
+static size_t
+_requal(const char *p, const char *q, size_t n)
+{
+	uint64_t x, y;
+	size_t i;
+
+	if (memcmp(p, q, n) == 0)
+		return n;
+
+	for (i = 0; i + sizeof(x) <= n; i += sizeof(x)) {
+		memcpy(&x, &p[n - i - sizeof(x)], sizeof(x));
+		memcpy(&y, &q[n - i - sizeof(y)], sizeof(y));
+		if (x != y)
+			break;
+	}
+	while (i < n && p[n - i - 1] == q[n - i - 1])
+		i++;
+
+	return i;
+}
+
+/*
+ * Finds where the text at (ai) of (a) and at (bj) of (b), which
+ * differ, have text in common again and stores the offsets to (na) and
+ * (nb). Without any, they are the ends of the text before the common
+ * suffix.
+ */
+static void
+_sync(struct diff *d, size_t ai, size_t bj, size_t *na, size_t *nb)
+{
+	size_t len, alen, blen, da, db;
+	char *p, *q;
+
+	for (len = EB_DIFFSCAN;; len *= 2) {
+		alen = d->aend - ai < len ? d->aend - ai : len;
+		blen = d->bend - bj < len ? d->bend - bj : len;
+		if ((alen == d->aend - ai && alen < EB_DIFFWIN) ||
+		    (blen == d->bend - bj && blen < EB_DIFFWIN))
+			break;
+
+		p = _copy(d->a, ai, alen, &d->abuf, &d->asize);
+		q = _copy(d->b, bj, blen, &d->bbuf, &d->bsize);
+		if (_find(p, alen, q, blen, &da, &db)) {
+			*na = ai + da;
+			*nb = bj + db;
+			return;
+		}
+
+		if (alen == d->aend - ai && blen == d->bend - bj)
+			break;
+	}
+
+	*na = d->aend;
+	*nb = d->bend;
+}
+
+/*
+ * Finds the closest EB_DIFFWIN bytes that (alen) bytes of (a) and
+ * (blen) bytes of (b) have in common and stores where the equal text
+ * around them begins to (da) and (db). Windows are hashed at every
+ * EB_DIFFSTEP bytes of (a) and at every byte of (b), so common text of
+ * at least EB_DIFFWIN + EB_DIFFSTEP - 1 bytes is always found.
+ *
+ * Returns non-zero if found.
+ */
+static int
+_find(const char *a, size_t alen, const char *b, size_t blen, size_t *da,
+    size_t *db)
+{
+	struct anchor *t;
+	uint64_t h, top;
+	size_t size, i, j, k, best;
+
+	if (alen < EB_DIFFWIN || blen < EB_DIFFWIN)
+		return 0;
+
+	for (size = 64; size < 2 * (alen / EB_DIFFSTEP + 1); size *= 2)
+		;
+	if ((t = calloc(size, sizeof(*t))) == NULL)
+		err(1, "making space for diff");
+
+	/* The first window of each hash in (a) */
+	for (i = 0; i + EB_DIFFWIN <= alen; i += EB_DIFFSTEP) {
+		h = _hash(&a[i]);
+		for (k = SLOT(h, size); t[k].off != 0 && t[k].hash != h;
+		    k = (k + 1) & (size - 1))
+			;
+		if (t[k].off == 0) {
+			t[k].hash = h;
+			t[k].off = i + 1;
+		}
+	}
+
+	for (top = 1, k = 1; k < EB_DIFFWIN; k++)
+		top *= HASHMUL;
+
+	/* Every window of (b) until nothing closer can be found */
+	best = SIZE_MAX;
+	h = _hash(b);
+	for (j = 0; j + EB_DIFFWIN <= blen && j < best; j++) {
+		if (j > 0)
+			h = (h - (unsigned char) b[j - 1] * top) * HASHMUL +
+			    (unsigned char) b[j + EB_DIFFWIN - 1];
+		for (k = SLOT(h, size); t[k].off != 0 && t[k].hash != h;
+		    k = (k + 1) & (size - 1))
+			;
+		if (t[k].off == 0 || (i = t[k].off - 1) + j >= best ||
+		    memcmp(&a[i], &b[j], EB_DIFFWIN) != 0)
+			continue;
+		best = i + j;
+		*da = i;
+		*db = j;
+	}
+	free(t);
+
+	if (best == SIZE_MAX)
+		return 0;
+
+	while (*da > 0 && *db > 0 && a[*da - 1] == b[*db - 1]) {
+		(*da)--;
+		(*db)--;
+	}
+	return 1;
+}
+
+/*
+ * Copies (len) bytes at (off) of (b) to (*buf) of (*size) bytes,
+ * growing it as needed, and returns it.
+ */
+static char *
+_copy(TxtBuffer *b, size_t off, size_t len, char **buf, size_t *size)
+{
+	size_t k, n;
+	char *p;
+
+	if (len > *size) {
+		free(*buf);
+		if ((*buf = malloc(len)) == NULL)
+			err(1, "making space for diff");
+		*size = len;
+	}
+
+	for (n = 0; n < len; n += k) {
+		if ((k = ebspan(b, off + n, &p)) == 0)
+			break;
+		if (k > len - n)
+			k = len - n;
+		memcpy(&(*buf)[n], p, k);
+	}
+
+	return *buf;
+}
+
+/*
+ * Returns the hash of EB_DIFFWIN bytes of (s) that can be rolled over
+ * to the next window.
+ */
+static uint64_t
+_hash(const char *s)
+{
+	uint64_t h;
+	size_t i;
+
+	for (h = 0, i = 0; i < EB_DIFFWIN; i++)
+		h = h * HASHMUL + (unsigned char) s[i];
+
+	return h;
+}
+
+static void
+_hunk(struct diff *d, size_t aoff, size_t alen, size_t boff, size_t blen)
+{
+	TxtHunk *h;
+
+	if (d->nout < d->n) {
+		h = &d->out[d->nout++];
+		h->aoff = aoff;
+		h->boff = boff;
+	} else
+		h = &d->out[d->nout - 1];
+
+	h->alen = aoff + alen - h->aoff;
+	h->blen = boff + blen - h->boff;
+}
@@ -21,7 +21,7 @@
 void
 ebdump(TxtBuffer *buffer)
 {
-	int i;
+	size_t i;
 	char ch;
 	size_t offset, o;
 	int invbg = 0;
@@ -51,7 +51,7 @@ ebdump(TxtBuffer *buffer)
 	for (i = 0; i < buffer->len; i++) {
 		if (i != 0 && i % 24 == 0)
 			putchar('\n');
-		printf("%2d ", i);
+		printf("%2zu ", i);
 	}
 	putchar('\n');
 
@@ -62,7 +62,7 @@ ebdump(TxtBuffer *buffer)
 
 		ch = ebget(buffer);
 		if (ch == 0) {
-			printf("at offset %d got NULL ch\n", i);
+			printf("at offset %zu got NULL ch\n", i);
 			printf("- why? buffer->root %lx\n",
 			    (intptr_t) buffer->root);
 			printf("- buffer->root_offset %zu\n",
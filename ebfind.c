@@ -15,18 +15,27 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE		/* memrchr */
 #include "editbuffer.h"
 
+static size_t	_findfwd(TxtBuffer *, char, size_t);
+static ssize_t	_findrev(TxtBuffer *, char, size_t);
+
 /*
  * Find character (c) from cursor index (i) onwards in increment (incr) steps,
  * until EOF or BOF from buffer (b). Returns the cursor index of the found
  * character or cursor index of EOF / BOF.
  */
-int
-ebfind(TxtBuffer *b, char c, int i, int incr)
+ssize_t
+ebfind(TxtBuffer *b, char c, ssize_t i, int incr)
 {
 	char ch;
 
+	if (incr == 1 && i >= 0 && i <= b->len)
+		return _findfwd(b, c, i);
+	if (incr == -1 && i >= 0 && i <= b->len)
+		return _findrev(b, c, i);
+
 	for (;;) {
 		if (i < 0 || i > b->len)
 			break;
@@ -45,11 +54,66 @@ ebfind(TxtBuffer *b, char c, int i, int incr)
 	return i;
 }
 
+/*
+ * Searches forward for (c) from (i) a block at a time.
+ */
+static size_t
+_findfwd(TxtBuffer *b, char c, size_t i)
+{
+	TxtBlock *np;
+	size_t k;
+	char *text, *p;
+
+	ebseek(b, i);
+	if ((np = b->root) == NULL)
+		return b->len;
+	k = LOCAL_OFFSET(b);
+	i -= k;
+
+	for (; np != NULL; i += np->len, np = np->next, k = 0) {
+		text = EBTEXT(b, np);
+		if (k < np->len &&
+		    (p = memchr(&text[k], c, np->len - k)) != NULL) {
+			i += p - text;
+			ebseek(b, i);
+			return i;
+		}
+	}
+
+	ebseek(b, b->len);
+	return b->len;
+}
+
+/*
+ * Searches backward for (c) from (i) a block at a time. Returns -1 if
+ * not found.
+ */
+static ssize_t
+_findrev(TxtBuffer *b, char c, size_t i)
+{
+	size_t end, n;
+	char *text, *p;
+
+	/* There is nothing to find at the end */
+	end = i < b->len ? i + 1 : b->len;
+
+	for (; (n = ebrspan(b, end, &text)) > 0; end -= n) {
+		if ((p = memrchr(text, c, n)) != NULL) {
+			end -= n - (p - text);
+			ebseek(b, end);
+			return end;
+		}
+	}
+
+	ebseek(b, 0);
+	return -1;
+}
+
 /*
  * Returns the beginning of next line from offset (i) in buffer (b).
  */
-int
-ebfindnext(TxtBuffer *b, int i)
+ssize_t
+ebfindnext(TxtBuffer *b, ssize_t i)
 {
 	if ((i = ebfind(b, '\n', i, 1)) == b->len)
 		return b->len;
@@ -59,8 +123,8 @@ ebfindnext(TxtBuffer *b, int i)
 /*
  * Returns the beginning of previous line from offset (i) in buffer (b).
  */
-int
-ebfindprev(TxtBuffer *b, int i)
+ssize_t
+ebfindprev(TxtBuffer *b, ssize_t i)
 {
 	if (i > 0)
 		i--;
@@ -74,8 +138,8 @@ ebfindprev(TxtBuffer *b, int i)
 /*
  * Returns the end of line offset ("EOL") from offset (i) in buffer (b).
  */
-int
-ebfindeol(TxtBuffer *b, int i)
+ssize_t
+ebfindeol(TxtBuffer *b, ssize_t i)
 {
 	return ebfind(b, '\n', i, 1);
 }
@@ -86,18 +150,18 @@ ebfindeol(TxtBuffer *b, int i)
  * Special case handling for the beginning of buffer: we'd simply return
  * the beginning of buffer offset as is which is always 0.
  */
-int
-ebfindbol(TxtBuffer *b, int i)
+ssize_t
+ebfindbol(TxtBuffer *b, ssize_t i)
 {
 	if ((i = ebfind(b, '\n', i, -1)) == 0)
 		return 0;
 	return ++i;
 }
 
-int
-eblinelen(TxtBuffer *b, int i)
+ssize_t
+eblinelen(TxtBuffer *b, ssize_t i)
 {
-	int eol, bol;
+	ssize_t eol, bol;
 
 	bol = ebfindbol(b, i);
 	eol = ebfindeol(b, i);
@@ -108,38 +172,32 @@ eblinelen(TxtBuffer *b, int i)
 }
 
 /*
- * Returns col within a line.
+ * Returns display col within a line, see ebcolumn.
  */
-int
-ebfindcol(TxtBuffer *b, int i)
+size_t
+ebfindcol(TxtBuffer *b, size_t i)
 {
-	int col;
-
-	col = (i - ebfindbol(b, i));
-	if (col < 0)	/* We're at EOL */
-		return eblinelen(b, i);
-
-	return col;
+	return ebcolumn(b, i);
 }
 
 /*
  * Returns cursor for x/y from pos
  */
-int
-ebfindxy(TxtBuffer *b, int x, int y, int pos)
+size_t
+ebfindxy(TxtBuffer *b, size_t x, size_t y, size_t pos)
 {
 	while (y > 0 && y--)
 		pos = ebfindnext(b, pos);
-	return (pos + x);
+	return ebcolpos(b, pos, x);
 }
 
 /*
  * Returns x/y delta from index p1 to index p2.
  */
 void
-ebfindxydelta(TxtBuffer *b, int p1, int p2, int *x, int *y)
+ebfindxydelta(TxtBuffer *b, size_t p1, size_t p2, size_t *x, size_t *y)
 {
-	int tmp;
+	size_t tmp;
 
 	*x = *y = 0;
 
@@ -156,33 +214,3 @@ ebfindxydelta(TxtBuffer *b, int p1, int p2, int *x, int *y)
 
 	*x = ebfindcol(b, p2);
 }
-
-char *
-ebwordat(TxtBuffer *b, int i)
-{
-	static char word[256 + 1];
-	int begin, end, ch;
-
-	begin = ebfind(b, ' ', i, -1);
-	end = ebfind(b, ' ', i, 1);
-
-	ebseek(b, begin + 1);
-
-	/* Normalize */
-	if (end != b->len && end != 0)
-		end--;
-	end = end - begin;
-	begin = 0;
-	while (begin < end) {
-		if (begin == sizeof(word) - 1)
-			break;
-		ch = ebget(b);
-		if (ch == EOF)
-			break;
-		word[begin] = (char) ch;
-		begin++;
-	}
-	word[begin] = '\0';
-
-	return word;
-}
@@ -23,7 +23,8 @@ ebget(TxtBuffer *buffer)
 	int ch;
 
 	if (buffer->root != NULL)
-		ch = (unsigned char) buffer->root->text[LOCAL_OFFSET(buffer)];
+		ch = (unsigned char)
+		    EBTEXT(buffer, buffer->root)[LOCAL_OFFSET(buffer)];
 	else
 		ch = EOF;
 
@@ -31,6 +32,70 @@ ebget(TxtBuffer *buffer)
 	return ch;
 }
 
+/*
+ * Moves the cursor of (buffer) back by one and returns the character
+ * there, or EOF at the beginning of the buffer. This is the reverse of
+ * ebget().
+ */
+int
+ebrget(TxtBuffer *buffer)
+{
+	if (buffer->offset == 0)
+		return EOF;
+
+	/* Within the same block */
+	if (buffer->root != NULL && LOCAL_OFFSET(buffer) > 0)
+		buffer->offset--;
+	else
+		ebseek(buffer, buffer->offset - 1);
+
+	return (unsigned char)
+	    EBTEXT(buffer, buffer->root)[LOCAL_OFFSET(buffer)];
+}
+
+/*
+ * Sets (p) to the text at (off) of (buffer) and returns how many bytes
+ * of it follow in the same block, or 0 at the end of the buffer. The
+ * cursor is moved to (off). The text is valid until the buffer is
+ * accessed again.
+ *
+ *	for (off = 0; (n = ebspan(b, off, &p)) > 0; off += n)
+ *		use n bytes at p;
+ */
+size_t
+ebspan(TxtBuffer *buffer, size_t off, char **p)
+{
+	ebseek(buffer, off);
+	if (buffer->root == NULL ||
+	    LOCAL_OFFSET(buffer) >= buffer->root->len)
+		return 0;
+
+	*p = &EBTEXT(buffer, buffer->root)[LOCAL_OFFSET(buffer)];
+	return buffer->root->len - LOCAL_OFFSET(buffer);
+}
+
+/*
+ * Sets (p) to the text of the block before (end) of (buffer) and
+ * returns how many bytes of it there are before (end), or 0 at the
+ * beginning of the buffer. The cursor is moved to the last of them.
+ * The text is valid until the buffer is accessed again.
+ *
+ *	for (end = b->len; (n = ebrspan(b, end, &p)) > 0; end -= n)
+ *		use n bytes at p backwards;
+ */
+size_t
+ebrspan(TxtBuffer *buffer, size_t end, char **p)
+{
+	if (end > buffer->len)
+		end = buffer->len;
+	if (end == 0)
+		return 0;
+
+	ebseek(buffer, end - 1);
+	*p = EBTEXT(buffer, buffer->root);
+	return LOCAL_OFFSET(buffer) + 1;
+}
+
 /*
  * Gets a slice up to maximum length or up to encountering delim and
  * stores the result to s, up to its maximum length.
@@ -43,14 +108,14 @@ ebget(TxtBuffer *buffer)
 ssize_t
 ebslice(TxtBuffer *buffer, char *delim, size_t slice, char *s, size_t len)
 {
-	int i;
+	size_t i;
 
 	for (i = 0; i < slice && i < len; i++) {
 		if (buffer->offset == buffer->len)
 			break;
 
 		if (buffer->root != NULL) {
-			s[i] = buffer->root->text[LOCAL_OFFSET(buffer)];
+			s[i] = EBTEXT(buffer, buffer->root)[LOCAL_OFFSET(buffer)];
 			if (delim != NULL && strchr(delim, s[i]) != NULL) {
 				ebseek(buffer, buffer->offset + 1);
 				break;
@@ -63,3 +128,56 @@ ebslice(TxtBuffer *buffer, char *delim, size_t slice, char *s, size_t len)
 
 	return i;
 }
+
+/*
+ * Gets the line at the cursor of (buffer) up to and including its
+ * newline and moves the cursor past it. A line within one block is
+ * not copied and (linep) is set to point to the block text. Otherwise
+ * up to (len) bytes of it are copied to (s), where (linep) is set to
+ * point, and the rest of a longer line is left for the next call like
+ * with fgets. The line is not NUL terminated and is valid until the
+ * buffer is accessed again.
+ *
+ * Returns the length of the line or 0 at the end of the buffer.
+ */
+size_t
+ebgetline(TxtBuffer *buffer, char **linep, char *s, size_t len)
+{
+	TxtBlock *np;
+	size_t k, n, m;
+	char *text, *p;
+
+	if ((np = buffer->root) == NULL)
+		return 0;
+	k = LOCAL_OFFSET(buffer);
+	text = EBTEXT(buffer, np);
+
+	if (k < np->len &&
+	    ((p = memchr(&text[k], '\n', np->len - k)) != NULL ||
+	    np->next == NULL)) {
+		n = p != NULL ? p - &text[k] + 1 : np->len - k;
+		*linep = &text[k];
+		if (k + n < np->len)
+			buffer->offset += n;	/* Still in the same block */
+		else
+			ebseek(buffer, buffer->offset + n);
+		return n;
+	}
+
+	for (n = 0; np != NULL && n < len; np = np->next, k = 0) {
+		text = EBTEXT(buffer, np);
+		m = np->len - k;
+		if (m > len - n)
+			m = len - n;
+		if ((p = memchr(&text[k], '\n', m)) != NULL)
+			m = p - &text[k] + 1;
+		memcpy(&s[n], &text[k], m);
+		n += m;
+		if (p != NULL)
+			break;
+	}
+	*linep = s;
+	ebseek(buffer, buffer->offset + n);
+
+	return n;
+}
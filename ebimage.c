@@ -0,0 +1,254 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Session images. An image has a header, a table with the length and
+ * the cached layout of every block and then the text of all blocks
+ * back to back. Restoring maps the image and points the blocks at
+ * their text in the mapping, so nothing is read or copied until it is
+ * accessed. A mapped block gets a private copy of its text when it is
+ * first modified, see EBWTEXT().
+ *
+ * The image is in native byte order and meant for the same machine.
+ */
+
+#include "editbuffer.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#define IMG_MAGIC	"EBIMAGE3"
+#define IMG_ORDER	0x01020304
+
+struct imghdr {
+	char magic[8];
+	uint32_t order;		/* Detects byte order */
+	uint32_t maxlen;	/* TXTBLOCK_MAXLEN */
+	uint64_t len;		/* Bytes of text */
+	uint64_t offset;	/* Cursor */
+	uint64_t lines;		/* Newlines in text */
+	uint64_t nblocks;
+	uint64_t textoff;	/* Start of text */
+};
+
+struct imgblock {
+	uint32_t len;
+	uint32_t flags;		/* Cached block flags */
+	uint64_t rows;
+	uint32_t rscol;
+	uint32_t recol;
+	uint32_t rwidth;
+	uint32_t pad;
+};
+
+#define IMG_FLAGS	(EBF_LAYOUT | EBF_LAYOUTNL | EBF_LAYOUTPEEK | EBF_ASCII | \
+			    EBF_SCANNED)
+
+static int	_check(struct imghdr *, size_t);
+
+/*
+ * Saves (buffer) as an image to (path), which is replaced as described
+ * at eb_savebegin.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int
+ebsave(TxtBuffer *buffer, const char *path)
+{
+	struct imghdr h;
+	struct imgblock ib;
+	TxtBlock *np;
+	char real[PATH_MAX], tmp[PATH_MAX], *text, *p, *end;
+	size_t save;
+	FILE *fp;
+	int error;
+
+	if ((fp = eb_savebegin(path, real, tmp)) == NULL)
+		return -1;
+
+	save = ebtell(buffer);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, IMG_MAGIC, sizeof(h.magic));
+	h.order = IMG_ORDER;
+	h.maxlen = TXTBLOCK_MAXLEN;
+	h.len = buffer->len;
+	h.offset = save;
+	for (np = eb_first(buffer); np != NULL; np = np->next)
+		if (np->len > 0)
+			h.nblocks++;
+	h.textoff = sizeof(h) + h.nblocks * sizeof(ib);
+	error = fwrite(&h, sizeof(h), 1, fp) != 1;
+
+	memset(&ib, 0, sizeof(ib));
+	for (np = eb_first(buffer); np != NULL && !error; np = np->next) {
+		if (np->len == 0)
+			continue;
+		ib.len = np->len;
+		ib.flags = np->flags & IMG_FLAGS;
+		ib.rows = np->rows;
+		ib.rscol = np->rscol;
+		ib.recol = np->recol;
+		ib.rwidth = np->rwidth;
+		error = fwrite(&ib, sizeof(ib), 1, fp) != 1;
+	}
+
+	for (np = eb_first(buffer); np != NULL && !error; np = np->next) {
+		text = EBTEXT(buffer, np);
+		error = fwrite(text, 1, np->len, fp) != np->len;
+		for (p = text, end = text + np->len;
+		    (p = memchr(p, '\n', end - p)) != NULL; p++)
+			h.lines++;
+	}
+
+	/* Now that the lines are known */
+	error = error || fseek(fp, 0, SEEK_SET) == -1 ||
+	    fwrite(&h, sizeof(h), 1, fp) != 1;
+
+	ebseek(buffer, save);
+
+	return eb_saveend(fp, real, tmp, error);
+}
+
+/*
+ * Restores an image saved with ebsave() from (path) to (buffer) which
+ * must be empty. The image must not be modified while it is in use.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int
+ebrestore(TxtBuffer *buffer, const char *path)
+{
+	struct imghdr *h;
+	struct imgblock *ib;
+	struct stat st;
+	TxtBlock *np, *prev;
+	char *map, *text;
+	size_t i, size;
+	int fd;
+
+	if (buffer->len > 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if ((size = st.st_size) < sizeof(*h)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	h = (struct imghdr *) map;
+	if (!_check(h, size)) {
+		munmap(map, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Drop the empty blocks and a previous image */
+	while ((np = buffer->last) != NULL) {
+		buffer->last = np->prev;
+		eb_freeblock(buffer, np);
+	}
+	buffer->root = NULL;
+	buffer->root_offset = buffer->offset = 0;
+	if (buffer->image != NULL)
+		munmap(buffer->image, buffer->imagelen);
+	buffer->image = NULL;
+	buffer->imagelen = 0;
+
+	/* Small enough to be stored inline */
+	if (h->len <= TXTBUFFER_INLINE) {
+		ebput(buffer, map + h->textoff, h->len);
+		ebseek(buffer, h->offset);
+		munmap(map, size);
+		return 0;
+	}
+
+	buffer->image = map;
+	buffer->imagelen = size;
+
+	ib = (struct imgblock *) (map + sizeof(*h));
+	text = map + h->textoff;
+	prev = NULL;
+	for (i = 0; i < h->nblocks; i++) {
+		np = eb_allocblock(buffer);
+		np->text = text;
+		np->len = ib[i].len;
+		np->flags = EBF_MAPPED | (ib[i].flags & IMG_FLAGS);
+		np->rows = ib[i].rows;
+		np->rscol = ib[i].rscol;
+		np->recol = ib[i].recol;
+		np->rwidth = ib[i].rwidth;
+		text += np->len;
+
+		if ((np->prev = prev) != NULL)
+			prev->next = np;
+		else
+			buffer->root = np;
+		prev = np;
+	}
+	buffer->last = prev;
+	buffer->len = h->len;
+
+	ebseek(buffer, h->offset);
+	eb_changed(buffer, 0, 0, h->len, (ssize_t) h->lines);
+
+	return 0;
+}
+
+/*
+ * Returns non-zero if image header (h) and the block table after it
+ * are consistent with an image of (size) bytes.
+ */
+static int
+_check(struct imghdr *h, size_t size)
+{
+	struct imgblock *ib;
+	uint64_t i, len;
+
+	if (memcmp(h->magic, IMG_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->order != IMG_ORDER || h->maxlen != TXTBLOCK_MAXLEN)
+		return 0;
+	if (h->nblocks > (size - sizeof(*h)) / sizeof(*ib) ||
+	    h->textoff != sizeof(*h) + h->nblocks * sizeof(*ib) ||
+	    h->len > size - h->textoff || h->offset > h->len)
+		return 0;
+
+	ib = (struct imgblock *) (h + 1);
+	for (i = 0, len = 0; i < h->nblocks; i++) {
+		if (ib[i].len == 0 || ib[i].len > TXTBLOCK_MAXLEN)
+			return 0;
+		len += ib[i].len;
+	}
+
+	return len == h->len;
+}
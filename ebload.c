@@ -0,0 +1,348 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Background loading. A reader thread reads the file in large chunks
+ * into a short queue and the thread that owns the buffer splices them
+ * in whenever it calls ebloadpoll(), for example between redraws. The
+ * buffer itself is only ever touched by its owner, so the part loaded
+ * so far can be viewed, searched and even edited as usual while the
+ * rest is still being read. A chunk is handed over when it is full or
+ * when a read returns less than asked, so text from a pipe or a slow
+ * device shows up as soon as it arrives.
+ */
+
+#include "editbuffer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define EB_LOADCHUNK	(1024 * 1024)	/* Most bytes read at a time */
+#define EB_LOADQUEUE	8		/* Chunks read ahead */
+
+struct txt_loadchunk {
+	struct txt_loadchunk *next;
+	size_t len;
+	char text[];
+};
+
+struct txt_load {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* Queue changed or cancelled */
+	int fd;
+	int wake[2];		/* Interrupts a read from a pipe on cancel */
+	size_t point;		/* Offset of the next chunk in the buffer */
+	size_t loaded;		/* Bytes spliced so far */
+	size_t total;		/* Size of the file, 0 if not known */
+	struct txt_loadchunk *head, *tail;
+	size_t nchunks;
+	int done;		/* Reader has finished */
+	int error;		/* Reader failed with this errno */
+	int cancel;
+};
+
+static void	*_reader(void *);
+static void	 _finish(TxtBuffer *);
+
+/*
+ * Starts appending the file at (path) to (buffer) in the background,
+ * see ebloadpoll.
+ *
+ * Returns 0 on success or -1 with errno set if the file could not be
+ * opened, or to EBUSY if a load is already in progress.
+ */
+int
+ebload_async(TxtBuffer *buffer, const char *path)
+{
+	TxtLoad *l;
+	struct stat st;
+	int fd, error;
+
+	if (buffer->load != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+
+	if ((l = calloc(1, sizeof(TxtLoad))) == NULL)
+		err(1, "making space for load");
+	if (pipe(l->wake) == -1) {
+		close(fd);
+		free(l);
+		return -1;
+	}
+	l->fd = fd;
+	l->point = buffer->len;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		l->total = st.st_size;
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_cond_init(&l->cond, NULL);
+
+	if ((error = pthread_create(&l->thread, NULL, _reader, l)) != 0) {
+		pthread_mutex_destroy(&l->lock);
+		pthread_cond_destroy(&l->cond);
+		close(l->wake[0]);
+		close(l->wake[1]);
+		close(fd);
+		free(l);
+		errno = error;
+		return -1;
+	}
+	buffer->load = l;
+
+	return 0;
+}
+
+/*
+ * Splices the chunks read so far to (buffer). If (wait) is non-zero,
+ * waits for at least one chunk or the end of the file first. Edits
+ * before the load point are fine, and the rest of the file goes after
+ * the text inserted there. The cursor stays where it was.
+ *
+ * Returns 1 if the load continues, 0 once the whole file has been
+ * loaded, or -1 with errno set if reading failed, in which case the
+ * load is over, or to ENOMEM if the memory budget ran out, see
+ * ebarena, in which case the load continues.
+ */
+int
+ebloadpoll(TxtBuffer *buffer, int wait)
+{
+	TxtLoad *l;
+	struct txt_loadchunk *cp, *next, *last;
+	size_t cursor, n;
+	int done, error;
+
+	if ((l = buffer->load) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&l->lock);
+	while (wait && l->head == NULL && !l->done)
+		pthread_cond_wait(&l->cond, &l->lock);
+	cp = l->head;
+	l->head = l->tail = NULL;
+	l->nchunks = 0;
+	done = l->done;
+	error = l->error;
+	pthread_cond_broadcast(&l->cond);
+	pthread_mutex_unlock(&l->lock);
+
+	cursor = buffer->offset;
+	for (; cp != NULL; cp = next) {
+		next = cp->next;
+		ebseek(buffer, l->point);
+		if (ebput(buffer, cp->text, cp->len) == -1)
+			break;
+		if (cursor > l->point - cp->len)
+			cursor += cp->len;
+		l->loaded += cp->len;
+		free(cp);
+	}
+	ebseek(buffer, cursor);
+
+	if (cp != NULL) {
+		/* Put the rest back for the next try */
+		for (n = 1, last = cp; last->next != NULL; last = last->next)
+			n++;
+		pthread_mutex_lock(&l->lock);
+		last->next = l->head;
+		if (l->head == NULL)
+			l->tail = last;
+		l->head = cp;
+		l->nchunks += n;
+		pthread_mutex_unlock(&l->lock);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (!done)
+		return 1;
+
+	_finish(buffer);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Stores the number of bytes of the file loaded to (buffer) so far to
+ * (loaded) and its size, or 0 if that is not known, to (total).
+ *
+ * Returns non-zero if a load is in progress.
+ */
+int
+ebloadprogress(TxtBuffer *buffer, size_t *loaded, size_t *total)
+{
+	TxtLoad *l;
+
+	if ((l = buffer->load) == NULL) {
+		*loaded = *total = 0;
+		return 0;
+	}
+	*loaded = l->loaded;
+	*total = l->total;
+	return 1;
+}
+
+/*
+ * Stops loading to (buffer). The text loaded so far is kept.
+ */
+void
+ebloadcancel(TxtBuffer *buffer)
+{
+	TxtLoad *l;
+
+	if ((l = buffer->load) == NULL)
+		return;
+
+	pthread_mutex_lock(&l->lock);
+	l->cancel = 1;
+	pthread_cond_broadcast(&l->cond);
+	pthread_mutex_unlock(&l->lock);
+	while (write(l->wake[1], "", 1) == -1 && errno == EINTR)
+		;
+
+	_finish(buffer);
+}
+
+/*
+ * Moves the load point after (newlen) bytes at (off) replaced
+ * (oldlen) bytes.
+ */
+void
+eb_loadchanged(TxtBuffer *buffer, size_t off, size_t oldlen, size_t newlen)
+{
+	TxtLoad *l;
+
+	l = buffer->load;
+	if (off + oldlen <= l->point)
+		l->point = l->point - oldlen + newlen;
+	else if (off < l->point)
+		l->point = off + newlen;
+}
+
+/*
+ * Waits for the reader of (buffer) to exit and releases the load.
+ */
+static void
+_finish(TxtBuffer *buffer)
+{
+	TxtLoad *l;
+	struct txt_loadchunk *cp, *next;
+
+	l = buffer->load;
+	pthread_join(l->thread, NULL);
+	pthread_mutex_destroy(&l->lock);
+	pthread_cond_destroy(&l->cond);
+	close(l->wake[0]);
+	close(l->wake[1]);
+	close(l->fd);
+	for (cp = l->head; cp != NULL; cp = next) {
+		next = cp->next;
+		free(cp);
+	}
+	free(l);
+	buffer->load = NULL;
+}
+
+static void *
+_reader(void *arg)
+{
+	TxtLoad *l = arg;
+	struct txt_loadchunk *cp;
+	struct pollfd pfd[2];
+	size_t want;
+	ssize_t n;
+	int error, done;
+
+	pfd[0].fd = l->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = l->wake[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if ((cp = malloc(sizeof(*cp) + EB_LOADCHUNK)) == NULL)
+			err(1, "making space for load");
+		cp->next = NULL;
+		cp->len = 0;
+		error = done = 0;
+		while (cp->len < EB_LOADCHUNK) {
+			/* A pipe blocks until ebloadcancel writes to wake */
+			if (poll(pfd, 2, -1) == -1) {
+				if (errno == EINTR)
+					continue;
+				error = errno;
+				done = 1;
+				break;
+			}
+			if (pfd[1].revents != 0)
+				break;
+			want = EB_LOADCHUNK - cp->len;
+			n = read(l->fd, &cp->text[cp->len], want);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				if (n == -1)
+					error = errno;
+				done = 1;
+				break;
+			}
+			cp->len += n;
+
+			/* Hand over what a pipe has so far */
+			if (n < want)
+				break;
+		}
+		if (cp->len < EB_LOADCHUNK &&
+		    (cp = realloc(cp, sizeof(*cp) + cp->len)) == NULL)
+			err(1, "making space for load");
+
+		pthread_mutex_lock(&l->lock);
+		while (l->nchunks == EB_LOADQUEUE && !l->cancel)
+			pthread_cond_wait(&l->cond, &l->lock);
+		if (l->cancel) {
+			pthread_mutex_unlock(&l->lock);
+			free(cp);
+			break;
+		}
+		if (done) {
+			l->done = 1;
+			l->error = error;
+		}
+		if (cp->len > 0) {
+			if (l->tail != NULL)
+				l->tail->next = cp;
+			else
+				l->head = cp;
+			l->tail = cp;
+			l->nchunks++;
+		} else
+			free(cp);
+		pthread_cond_broadcast(&l->cond);
+		pthread_mutex_unlock(&l->lock);
+		if (done)
+			break;
+	}
+
+	return NULL;
+}
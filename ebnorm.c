@@ -0,0 +1,284 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Normalization of freshly loaded text. A single pass over the blocks
+ * counts the line endings, converts CRLF to LF if asked to, validates
+ * UTF-8 and records which blocks are pure ASCII, so that the UTF-8 code
+ * can treat their bytes as characters without decoding them.
+ *
+ * ASCII is detected a word at a time by testing the high bits of eight
+ * bytes at once.
+ */
+
+#include "editbuffer.h"
+#include <stdint.h>
+
+#define HIGHBITS	0x8080808080808080ULL
+
+struct utf8 {
+	size_t need;		/* Continuation bytes still expected */
+	unsigned char lo, hi;	/* Range of the next continuation byte */
+	size_t start;		/* Offset of the sequence */
+};
+
+static int	_isascii(const char *, size_t);
+static size_t	_crlf(TxtBuffer *, TxtBlock *, TxtBlock *, size_t, size_t,
+		    size_t *, TxtNorm *, int);
+static void	_validate(struct utf8 *, const char *, size_t, size_t,
+		    TxtNorm *);
+static void	_invalid(TxtNorm *, size_t);
+
+/*
+ * Scans all text of (buffer) and stores what was found to (norm),
+ * unless it is NULL. With EBN_LF in (flags) line endings are converted
+ * from CRLF to LF. The cursor stays on the text it was on.
+ */
+void
+ebnormalize(TxtBuffer *buffer, int flags, TxtNorm *norm)
+{
+	TxtNorm n;
+	TxtBlock *np, *prev, *next;
+	struct utf8 u;
+	size_t off, prevoff, oldoff, oldlen, first, len, cursor, shift;
+
+	memset(&n, 0, sizeof(n));
+	memset(&u, 0, sizeof(u));
+	n.badoff = SIZE_MAX;
+
+	len = buffer->len;
+	cursor = buffer->offset;
+	shift = 0;
+	first = SIZE_MAX;
+	ebseek(buffer, 0);
+
+	prev = NULL;
+	off = prevoff = oldoff = 0;
+	for (np = buffer->root; np != NULL; np = next) {
+		next = np->next;
+		oldlen = np->len;
+		if (_crlf(buffer, prev, np, oldoff, cursor, &shift, &n,
+		    flags) > 0 && first == SIZE_MAX)
+			first = prev != NULL ? prevoff : 0;
+		oldoff += oldlen;
+
+		/* A block may have been nothing but the CR of a CRLF */
+		if (prev != NULL && prev->len == 0) {
+			if ((np->prev = prev->prev) != NULL)
+				np->prev->next = np;
+			eb_freeblock(buffer, prev);
+		} else if (prev != NULL)
+			off = prevoff + prev->len;
+
+		if (!EBASCII(buffer, np) || u.need > 0)
+			_validate(&u, EBTEXT(buffer, np), np->len, off, &n);
+
+		prev = np;
+		prevoff = off;
+	}
+	if (u.need > 0)
+		_invalid(&n, u.start);
+
+	if (n.badoff == SIZE_MAX)
+		n.badoff = off + (prev != NULL ? prev->len : 0);
+	if (norm != NULL)
+		*norm = n;
+	if (first == SIZE_MAX) {
+		ebseek(buffer, cursor);
+		return;
+	}
+
+	/* Start over from the first block */
+	for (np = buffer->last; np != NULL && np->prev != NULL; np = np->prev)
+		;
+	buffer->len = off + prev->len;
+	buffer->root = np;
+	buffer->root_offset = buffer->offset = 0;
+	ebseek(buffer, cursor - shift);
+
+	eb_changed(buffer, first, len - first, buffer->len - first, 0);
+}
+
+/*
+ * Returns non-zero if the text of (block) is all ASCII and remembers
+ * it until the block is modified. Use EBASCII().
+ */
+int
+eb_ascii(TxtBuffer *buffer, TxtBlock *block)
+{
+	block->flags |= EBF_SCANNED;
+	if (_isascii(EBTEXT(buffer, block), block->len))
+		block->flags |= EBF_ASCII;
+	else
+		block->flags &= ~EBF_ASCII;
+
+	return block->flags & EBF_ASCII;
+}
+
+static int
+_isascii(const char *s, size_t n)
+{
+	uint64_t w, acc;
+	size_t i;
+
+	acc = 0;
+	for (i = 0; i + sizeof(w) <= n; i += sizeof(w)) {
+		memcpy(&w, &s[i], sizeof(w));
+		acc |= w;
+	}
+	for (; i < n; i++)
+		acc |= (unsigned char) s[i];
+
+	return (acc & HIGHBITS) == 0;
+}
+
+/*
+ * Counts the line endings of block (np), which follows (prev), and
+ * removes the CR of each CRLF with EBN_LF in (flags), including a CR
+ * at the end of (prev). The text of (np) was at (oldoff) before any
+ * removals. Counts the CRs removed before (cursor) to (shift).
+ *
+ * Returns the number of CRs removed.
+ */
+static size_t
+_crlf(TxtBuffer *buffer, TxtBlock *prev, TxtBlock *np, size_t oldoff,
+    size_t cursor, size_t *shift, TxtNorm *n, int flags)
+{
+	char *text, *p, *end, *r, *w;
+	size_t removed, here, k;
+	int prevcr, f;
+
+	prevcr = prev != NULL && prev->len > 0 &&
+	    EBTEXT(buffer, prev)[prev->len - 1] == '\r';
+
+	text = EBTEXT(buffer, np);
+	end = text + np->len;
+	removed = here = 0;
+	r = w = NULL;
+	for (p = text; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+		if (p > text ? p[-1] != '\r' : !prevcr) {
+			n->lf++;
+			continue;
+		}
+		n->crlf++;
+		if (!(flags & EBN_LF))
+			continue;
+		removed++;
+
+		if (p == text) {
+			/* Deleting from the end does not touch the text */
+			f = prev->flags & (EBF_SCANNED | EBF_ASCII);
+			prev->len--;
+			EBMODIFIED(prev);
+			prev->flags |= f;
+			if (oldoff - 1 < cursor)
+				(*shift)++;
+			continue;
+		}
+
+		/* Close the gap of each CR once the next one is found */
+		if (oldoff + (p - text) - 1 < cursor)
+			(*shift)++;
+		if (here++ == 0) {
+			if (np->flags & EBF_BORROWED) {
+				k = p - text;
+				text = EBWTEXT(buffer, np);
+				end = text + np->len;
+				p = text + k;
+			}
+			w = p - 1;
+		} else {
+			memmove(w, r, p - 1 - r);
+			w += p - 1 - r;
+		}
+		r = p;
+	}
+
+	if (here > 0) {
+		memmove(w, r, end - r);
+		np->len -= here;
+		EBMODIFIED(np);
+	}
+
+	return removed;
+}
+
+/*
+ * Checks (len) bytes of UTF-8 in (s) at (off), continuing from the
+ * state in (u).
+ */
+static void
+_validate(struct utf8 *u, const char *s, size_t len, size_t off,
+    TxtNorm *n)
+{
+	uint64_t w;
+	size_t i;
+	unsigned char c;
+
+	for (i = 0; i < len; i++) {
+		c = s[i];
+		if (u->need > 0) {
+			if (c >= u->lo && c <= u->hi) {
+				u->need--;
+				u->lo = 0x80;
+				u->hi = 0xBF;
+				continue;
+			}
+			_invalid(n, u->start);
+			u->need = 0;
+		}
+
+		u->start = off + i;
+		u->lo = 0x80;
+		u->hi = 0xBF;
+		if (c < 0x80) {
+			/* Skip a run of ASCII a word at a time */
+			while (i + 1 + sizeof(w) <= len) {
+				memcpy(&w, &s[i + 1], sizeof(w));
+				if (w & HIGHBITS)
+					break;
+				i += sizeof(w);
+			}
+		} else if (c >= 0xC2 && c <= 0xDF)
+			u->need = 1;
+		else if (c == 0xE0) {
+			u->need = 2;
+			u->lo = 0xA0;
+		} else if (c == 0xED) {
+			u->need = 2;
+			u->hi = 0x9F;
+		} else if (c >= 0xE1 && c <= 0xEF)
+			u->need = 2;
+		else if (c == 0xF0) {
+			u->need = 3;
+			u->lo = 0x90;
+		} else if (c >= 0xF1 && c <= 0xF3)
+			u->need = 3;
+		else if (c == 0xF4) {
+			u->need = 3;
+			u->hi = 0x8F;
+		} else
+			_invalid(n, off + i);
+	}
+}
+
+static void
+_invalid(TxtNorm *n, size_t off)
+{
+	if (n->invalid++ == 0)
+		n->badoff = off;
+}
@@ -19,21 +19,72 @@
 #include <stdint.h>
 
 static void _backtrack_or_create_new(TxtBuffer *buffer);
-static TxtBlock* _new(TxtBuffer *buffer, TxtBlock *parent);
 static size_t _insert(TxtBuffer *buffer, TxtBlock *block, char *s, size_t len);
-static void _split(TxtBuffer *buffer, TxtBlock *block);
+static TxtBlock *_before(TxtBuffer *buffer, TxtBlock *block);
+static void _promote(TxtBuffer *buffer, TxtBlock *block);
+static size_t _chunks(TxtBuffer *buffer, size_t offset, size_t len);
 
-void
+/*
+ * Inserts (len) bytes from (s) at the cursor of (buffer).
+ *
+ * Returns (len) or -1 with errno set to ENOMEM if the memory budget
+ * ran out, see ebarena, in which case nothing is changed.
+ */
+ssize_t
 ebput(TxtBuffer *buffer, char *s, size_t len)
 {
 	size_t i, n, offset;
+	ssize_t lines;
+	char *p;
 
 	offset = buffer->offset;
+	if (offset > buffer->len)
+		offset = buffer->len;
+	if ((n = _chunks(buffer, offset, len)) > 0 &&
+	    eb_reserve(buffer, n) == -1)
+		return -1;
+
 	for (i = 0; i < len; i += n) {
 		ebseek(buffer, offset + i);
 		_backtrack_or_create_new(buffer);
 		n = _insert(buffer, buffer->root, &s[i], len - i);
 	}
+
+	if (len == 0)
+		return 0;
+	lines = 0;
+	for (p = s; (p = memchr(p, '\n', len - (p - s))) != NULL; p++)
+		lines++;
+	eb_changed(buffer, offset, 0, len, lines);
+
+	return len;
+}
+
+/*
+ * Returns the number of text chunks that inserting (len) bytes at
+ * (offset) may need at most.
+ */
+static size_t
+_chunks(TxtBuffer *buffer, size_t offset, size_t len)
+{
+	TxtBlock *block;
+
+	ebseek(buffer, offset);
+	if ((block = buffer->root) == NULL)
+		block = buffer->last;
+
+	if (block == NULL) {
+		if (len <= TXTBUFFER_INLINE)
+			return 0;
+	} else if (EBINLINE(buffer, block)) {
+		if (block->len + len <= TXTBUFFER_INLINE)
+			return 0;
+	} else if (block->text != NULL && !(block->flags & EBF_BORROWED) &&
+	    block->len + len <= TXTBLOCK_MAXLEN)
+		return 0;
+
+	/* Full blocks of the text, a split at the cursor and a fault or two */
+	return (len + TXTBLOCK_MAXLEN - 1) / TXTBLOCK_MAXLEN + 3;
 }
 
 /*
@@ -46,97 +97,85 @@ _backtrack_or_create_new(TxtBuffer *buffer)
 		buffer->root_offset -= buffer->last->len;
 		buffer->root = buffer->last;
 	} else if (buffer->root == NULL) {
-		buffer->root = _new(buffer, NULL);
+		buffer->root = eb_newblock(buffer, NULL);
 	}
 }
 
-static TxtBlock*
-_new(TxtBuffer *buffer, TxtBlock *parent)
+/*
+ * Returns a new empty block linked before (block).
+ */
+static TxtBlock *
+_before(TxtBuffer *buffer, TxtBlock *block)
 {
-	TxtBlock *block;
-	static size_t blockno = 0;
-	
-	if ((block = calloc(1, sizeof(TxtBlock))) == NULL)
-		goto alloc_err;
-
-	block->blockno = ++blockno;
-
-	block->prev = parent;
-	if (parent != NULL) {
-		block->next = parent->next;
-		if (block->next)
-			block->next->prev = block;
-		parent->next = block;
-	}
-
-	if (block->next == NULL)
-		buffer->last = block;
-
-	block->len = 0;
-
-	buffer->alloc += (TXTBLOCK_ALLOC + sizeof(TxtBlock));
-	buffer->blocks++;
-
-	if ((block->text = calloc(1, TXTBLOCK_ALLOC)) == NULL)
-		goto alloc_err;
+	TxtBlock *new_block;
 
-	return block;
+	if (block->prev != NULL)
+		return eb_newblock(buffer, block->prev);
 
-alloc_err:
-	err(1, "making space for new text");
+	new_block = eb_allocblock(buffer);
+	new_block->next = block;
+	block->prev = new_block;
+	return new_block;
 }
 
+/*
+ * Moves the text of the inline block to a regular allocation once it
+ * would overflow.
+ */
 static void
-_split(TxtBuffer *buffer, TxtBlock *block)
+_promote(TxtBuffer *buffer, TxtBlock *block)
 {
-	TxtBlock *new_block;
-	char *src, *dst;
-
-	new_block = _new(buffer, block);
-
-	src = &(block->text[block->len / 2]);
-	dst = &(new_block->text[0]);
-
-	memcpy(dst, src, block->len / 2);
-
-	new_block->len = TXTBLOCK_MAXLEN / 2;
-	block->len /= 2;
+	block->text = NULL;	/* Faults in a new allocation */
+	memcpy(EBTEXT(buffer, block), buffer->smalltext, block->len);
 }
 
 static size_t
 _insert(TxtBuffer *buffer, TxtBlock *block, char *s, size_t len)
 {
-	char *dst, *src;
+	char *dst, *src, *text;
 	size_t loffset, space, clear, i;
 
+	if (EBINLINE(buffer, block) && block->len + len > TXTBUFFER_INLINE)
+		_promote(buffer, block);
+
+	/*
+	 * Text that does not fit goes to new blocks at the cursor, which
+	 * are filled up, so that the blocks an insert takes are about
+	 * the same as the blocks of its text.
+	 */
 	loffset = LOCAL_OFFSET(buffer);
-	if (block->len == TXTBLOCK_MAXLEN && loffset < block->len) {
-		_split(buffer, block);
-		ebseek(buffer, buffer->offset);
-		_backtrack_or_create_new(buffer);
-		loffset = LOCAL_OFFSET(buffer);
-	} else if (block->len == TXTBLOCK_MAXLEN) {
-		_new(buffer, block);
-		ebseek(buffer, buffer->offset);
-		_backtrack_or_create_new(buffer);
+	if (block->len + len > TXTBLOCK_MAXLEN) {
+		if (loffset == 0 && block->len > 0)
+			buffer->root = _before(buffer, block);
+		else if (loffset < block->len)
+			eb_cut(buffer, buffer->offset);
+		else if (block->len == TXTBLOCK_MAXLEN) {
+			/* Appending past a full block, which is done with */
+			if (buffer->dedup)
+				eb_dedup(buffer, block);
+			buffer->root = eb_newblock(buffer, block);
+			buffer->root_offset += block->len;
+		}
 		loffset = LOCAL_OFFSET(buffer);
 	}
 	block = buffer->root;
+	text = EBWTEXT(buffer, block);
 
 	space = (TXTBLOCK_MAXLEN - block->len);
 	clear = len > space ? space : len;
 
 	if (loffset < block->len) {
-		dst = &(block->text[loffset + clear]);
-		src = &(block->text[loffset]);
+		dst = &(text[loffset + clear]);
+		src = &(text[loffset]);
 		memmove(dst, src, (block->len - loffset) * sizeof(char));
 	}
 
 	block->len += clear;
 	buffer->len += clear;
+	EBMODIFIED(block);
 
 	for (i = 0; i < clear; i++)
-		block->text[loffset++] = s[i];
+		text[loffset++] = s[i];
 
 	return clear;
 }
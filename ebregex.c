@@ -0,0 +1,1415 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Regular expressions searched directly in the text of the blocks,
+ * without copying the text anywhere. The pattern is compiled to a
+ * Thompson NFA for both directions, and the NFA is run as DFAs whose
+ * states are built lazily, when the text first leads to them, and
+ * cached. A DFA state is all that is carried from one block to the
+ * next.
+ *
+ * A match is the leftmost and then the longest one. Searching takes
+ * these steps:
+ *
+ *	1. A DFA that restarts at every byte scans forward for the
+ *	   first position where some match ends. While it is not in the
+ *	   middle of anything, it skips text to the next byte that a
+ *	   match may begin with, using memchr() if there is only one.
+ *	2. A reverse DFA scans backward from there to find how far back
+ *	   a match that ends later may still begin.
+ *	3. The NFA is simulated from there, keeping track of where each
+ *	   thread began, until the leftmost beginning is certain.
+ *	4. An anchored DFA scans forward from the beginning to find the
+ *	   longest match.
+ *
+ * Only the first step looks at text that is not near the match.
+ * Searching backward takes a reverse DFA that restarts at every byte
+ * and the last step.
+ *
+ * The syntax is that of extended regular expressions:
+ *
+ *	a	the byte a, unless special
+ *	\c	c literally, or \n \t \r, or \d \D \w \W \s \S
+ *	.	a character but newline, i.e. a byte with the UTF-8
+ *		continuation bytes that follow it
+ *	[a-z]	a byte in the set, [^a-z] one not in it nor newline
+ *	^ $	beginning and end of a line
+ *	r*	zero or more, r+ one or more, r? zero or one of r
+ *	r{m,n}	m to n, r{m,} m or more and r{m} m of r
+ *	rs	r followed by s, r|s r or s, (r) r
+ */
+
+#define _GNU_SOURCE		/* memrchr */
+#include "editbuffer.h"
+#include <errno.h>
+#include <stdint.h>
+
+#define EB_REGEXNODES	10000		/* NFA nodes of a pattern */
+#define EB_REGEXREP	1000		/* Largest count of r{m,n} */
+#define EB_REGEXMEM	(1024 * 1024)	/* Cached states of a DFA */
+
+#define ISSET(set, c)	((set)[(c) >> 3] & (1 << ((c) & 7)))
+#define ADDSET(set, c)	((set)[(c) >> 3] |= (1 << ((c) & 7)))
+
+enum {
+	RA_SET,			/* Byte in set */
+	RA_CAT,			/* l followed by r */
+	RA_ALT,			/* l or r */
+	RA_REPEAT,		/* min to max of l, max -1 for unbounded */
+	RA_BOL,
+	RA_EOL,
+	RA_EMPTY
+};
+
+struct rast {
+	int type;
+	int l, r;
+	int min, max;
+	unsigned char set[32];
+};
+
+struct parse {
+	const char *p;
+	int flags;
+	struct rast *ast;
+	size_t n;
+	size_t max;
+};
+
+enum {
+	RN_BYTES,		/* Byte in set, then out */
+	RN_SPLIT,		/* Both out and out1 */
+	RN_PREV,		/* Out if the byte before is a newline */
+	RN_NEXT,		/* Out if the byte after is a newline */
+	RN_MATCH
+};
+
+struct rnode {
+	int type;
+	int out, out1;
+	unsigned char set[32];
+};
+
+/*
+ * The NFA for one direction. Searching backward runs an NFA compiled
+ * from the pattern reversed, where ^ looks at the byte after and $ at
+ * the byte before.
+ */
+struct rnfa {
+	struct rnode *node;
+	size_t n;
+	size_t max;
+	int start;
+	unsigned char lead[32];	/* Bytes matches may begin with */
+	int first;		/* Byte all matches begin with, or -1 */
+	int skip;		/* Some byte cannot begin a match */
+};
+
+#define NL_PREV		0x01	/* Newline or nothing is the byte before */
+#define NL_NEXT		0x02	/* Newline or nothing is the byte after */
+
+#define DS_MATCH	0x01	/* A match ends here */
+#define DS_MATCHNEXT	0x02	/* One does if a newline comes next */
+#define DS_ACCEPT	(DS_MATCH | DS_MATCHNEXT)
+#define DS_PREVNL	0x04	/* Newline was the byte before */
+#define DS_START	0x08	/* Nothing is going on */
+#define DS_DEAD		0x10	/* Nothing can match anymore */
+
+struct dstate {
+	struct dstate *hnext;
+	uint64_t hash;
+	int flags;
+	int *set;		/* NFA nodes, sorted */
+	size_t n;
+	struct dstate *next[];	/* By byte class, NULL until needed */
+};
+
+enum {
+	RD_ANCHORED,		/* Starts at one position */
+	RD_UNANCHORED,		/* Starts at every position */
+	RD_ALL			/* Starts in every NFA node */
+};
+
+struct rdfa {
+	struct rnfa *nfa;
+	int mode;
+	struct dstate *start[2];	/* By DS_PREVNL */
+	struct dstate **table;
+	size_t size;
+	size_t nstates;
+	size_t mem;
+	size_t flushes;
+};
+
+struct rthread {
+	int node;
+	size_t start;
+};
+
+struct txt_regex {
+	struct rnfa fwd, rev;
+	unsigned char class[256];	/* Byte class of each byte */
+	size_t nclass;
+	struct rdfa find;	/* Forward, finds where matches end */
+	struct rdfa rfind;	/* Backward, finds where matches begin */
+	struct rdfa prefix;	/* Backward, finds where threads began */
+	struct rdfa longest;	/* Forward from where a match begins */
+	size_t *mark;		/* Generation that visited each node */
+	size_t gen;
+	int *set, *tmp, *stack;
+	struct rthread *clist, *nlist;
+};
+
+#define STEP(re, d, s, c)	((s)->next[(re)->class[c]] != NULL ? \
+	(s)->next[(re)->class[c]] : _step((re), (d), (s), (c)))
+
+static ssize_t		 _find(TxtBuffer *, TxtRegex *, size_t, size_t *);
+static ssize_t		 _end(TxtBuffer *, TxtRegex *, size_t);
+static ssize_t		 _rbegin(TxtBuffer *, TxtRegex *, size_t);
+static size_t		 _prefix(TxtBuffer *, TxtRegex *, size_t, size_t);
+static size_t		 _leftmost(TxtBuffer *, TxtRegex *, size_t);
+static size_t		 _longest(TxtBuffer *, TxtRegex *, size_t);
+static size_t		 _skip(struct rnfa *, const char *, size_t, size_t);
+static size_t		 _rskip(struct rnfa *, const char *, size_t);
+static int		 _byte(TxtBuffer *, size_t);
+static int		 _accept(struct dstate *, int);
+static void		 _thread(TxtRegex *, struct rthread *, size_t *, int,
+			    size_t, int);
+static struct dstate	*_start(TxtRegex *, struct rdfa *, int);
+static struct dstate	*_step(TxtRegex *, struct rdfa *, struct dstate *,
+			    int);
+static struct dstate	*_state(TxtRegex *, struct rdfa *, int *, size_t,
+			    int);
+static void		 _closure(TxtRegex *, struct rnfa *, int, int, int *,
+			    size_t *);
+static void		 _flush(struct rdfa *);
+static int		 _cmp(const void *, const void *);
+static int		 _alt(struct parse *);
+static int		 _cat(struct parse *);
+static int		 _repeat(struct parse *);
+static int		 _atom(struct parse *);
+static int		 _class(struct parse *, unsigned char *);
+static int		 _escape(struct parse *, unsigned char *);
+static int		 _count(struct parse *, int *);
+static void		 _fold(struct parse *, unsigned char *);
+static int		 _ast(struct parse *, int, int, int);
+static int		 _set(struct parse *, const unsigned char *);
+static int		 _compile(struct rnfa *, struct parse *, int, int);
+static int		 _emit(struct rnfa *, struct parse *, int, int, int);
+static int		 _node(struct rnfa *, int, int, int);
+static void		 _lead(TxtRegex *, struct rnfa *);
+static void		 _classes(TxtRegex *);
+static void		 _refine(TxtRegex *, const unsigned char *);
+
+/*
+ * Compiles (pattern) for searching, see the syntax above. With EBR_ICASE
+ * in (flags) ASCII letters match either case.
+ *
+ * Returns the regex, which is freed with ebregfree(), or NULL with
+ * errno set to EINVAL if the pattern is not valid or too large.
+ */
+TxtRegex *
+ebregcomp(const char *pattern, int flags)
+{
+	TxtRegex *re;
+	struct parse ps;
+	int root;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = pattern;
+	ps.flags = flags;
+	if ((root = _alt(&ps)) == -1 || *ps.p != '\0') {
+		free(ps.ast);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((re = calloc(1, sizeof(TxtRegex))) == NULL)
+		err(1, "making space for regex");
+	if (_compile(&re->fwd, &ps, root, 0) == -1 ||
+	    _compile(&re->rev, &ps, root, 1) == -1) {
+		free(ps.ast);
+		ebregfree(re);
+		errno = EINVAL;
+		return NULL;
+	}
+	free(ps.ast);
+
+	if ((re->mark = calloc(re->fwd.n, sizeof(size_t))) == NULL ||
+	    (re->set = reallocarray(NULL, re->fwd.n, sizeof(int))) == NULL ||
+	    (re->tmp = reallocarray(NULL, re->fwd.n, sizeof(int))) == NULL ||
+	    (re->stack = reallocarray(NULL, 2 * re->fwd.n + 1,
+	    sizeof(int))) == NULL ||
+	    (re->clist = reallocarray(NULL, re->fwd.n,
+	    sizeof(struct rthread))) == NULL ||
+	    (re->nlist = reallocarray(NULL, re->fwd.n,
+	    sizeof(struct rthread))) == NULL)
+		err(1, "making space for regex");
+
+	_classes(re);
+	_lead(re, &re->fwd);
+	_lead(re, &re->rev);
+
+	re->find.nfa = &re->fwd;
+	re->find.mode = RD_UNANCHORED;
+	re->longest.nfa = &re->fwd;
+	re->longest.mode = RD_ANCHORED;
+	re->rfind.nfa = &re->rev;
+	re->rfind.mode = RD_UNANCHORED;
+	re->prefix.nfa = &re->rev;
+	re->prefix.mode = RD_ALL;
+
+	return re;
+}
+
+/*
+ * Frees (re).
+ */
+void
+ebregfree(TxtRegex *re)
+{
+	struct rdfa *d[] = { &re->find, &re->rfind, &re->prefix,
+	    &re->longest };
+	size_t i;
+
+	for (i = 0; i < sizeof(d) / sizeof(d[0]); i++) {
+		_flush(d[i]);
+		free(d[i]->table);
+	}
+	free(re->fwd.node);
+	free(re->rev.node);
+	free(re->mark);
+	free(re->set);
+	free(re->tmp);
+	free(re->stack);
+	free(re->clist);
+	free(re->nlist);
+	free(re);
+}
+
+/*
+ * Finds the first match of (re) in (b) that begins at or after (off),
+ * or with negative (incr) the one that begins last among those that
+ * begin before (off) and end at or before it. Stores the length of the
+ * longest match from there to (len), which may reach past (off). The
+ * cursor stays where it was. A regex must not be used by two threads
+ * at once.
+ *
+ * Returns the offset of the match or -1 if there is none.
+ */
+ssize_t
+ebregfind(TxtBuffer *b, TxtRegex *re, size_t off, int incr, size_t *len)
+{
+	size_t cursor;
+	ssize_t begin;
+
+	cursor = b->offset;
+	if (off > b->len)
+		off = b->len;
+
+	if (incr >= 0)
+		begin = _find(b, re, off, len);
+	else if ((begin = _rbegin(b, re, off)) != -1)
+		*len = _longest(b, re, begin) - begin;
+
+	ebseek(b, cursor);
+	return begin;
+}
+
+/*
+ * Stores up to (n) matches of (re) in (b) from (off) on to (out), in
+ * order. Matches do not overlap, and an empty match is not found right
+ * where another match ends. The cursor stays where it was.
+ *
+ * Returns the number of matches stored.
+ */
+size_t
+ebregall(TxtBuffer *b, TxtRegex *re, size_t off, TxtMatch *out, size_t n)
+{
+	size_t cursor, i, len;
+	ssize_t begin;
+
+	cursor = b->offset;
+	for (i = 0; i < n && off <= b->len; i++) {
+		if ((begin = _find(b, re, off, &len)) == -1)
+			break;
+		if (len == 0 && i > 0 && begin == out[i - 1].off +
+		    out[i - 1].len && out[i - 1].len > 0) {
+			off = begin + 1;
+			i--;
+			continue;
+		}
+		out[i].off = begin;
+		out[i].len = len;
+		off = begin + (len > 0 ? len : 1);
+	}
+
+	ebseek(b, cursor);
+	return i;
+}
+
+static ssize_t
+_find(TxtBuffer *b, TxtRegex *re, size_t off, size_t *len)
+{
+	ssize_t end;
+	size_t begin;
+
+	if ((end = _end(b, re, off)) == -1)
+		return -1;
+	begin = _leftmost(b, re, _prefix(b, re, end, off));
+	*len = _longest(b, re, begin) - begin;
+
+	return begin;
+}
+
+/*
+ * Returns the offset where the first match that ends at or after
+ * (off) ends, or -1 if there is none.
+ */
+static ssize_t
+_end(TxtBuffer *b, TxtRegex *re, size_t off)
+{
+	struct rdfa *d;
+	struct dstate *s;
+	size_t pos, i, j, k;
+	char *text;
+	unsigned char c;
+
+	d = &re->find;
+	s = _start(re, d, off == 0 || _byte(b, off - 1) == '\n');
+	for (pos = off; (k = ebspan(b, pos, &text)) > 0; pos += k) {
+		for (i = 0; i < k; i++) {
+			/* Skip to a byte that may begin a match */
+			if ((s->flags & DS_START) && re->fwd.skip) {
+				if ((j = _skip(&re->fwd, text, i, k)) == k) {
+					s = _start(re, d, text[k - 1] == '\n');
+					break;
+				}
+				if (j > i)
+					s = _start(re, d, text[j - 1] == '\n');
+				i = j;
+			}
+
+			c = text[i];
+			if ((s->flags & DS_ACCEPT) && _accept(s, c))
+				return pos + i;
+			s = STEP(re, d, s, c);
+		}
+	}
+
+	if ((s->flags & DS_ACCEPT) && _accept(s, EOF))
+		return pos;
+	return -1;
+}
+
+/*
+ * Returns the offset of the last match that begins before (off) and
+ * ends at or before it, or -1 if there is none.
+ */
+static ssize_t
+_rbegin(TxtBuffer *b, TxtRegex *re, size_t off)
+{
+	struct rdfa *d;
+	struct dstate *s;
+	size_t pos, i, j, k, at;
+	char *text;
+	unsigned char c;
+
+	d = &re->rfind;
+	s = _start(re, d, off == b->len || _byte(b, off) == '\n');
+	for (pos = off; (k = ebrspan(b, pos, &text)) > 0; pos -= k) {
+		for (i = k; i > 0; i--) {
+			/* Skip back to a byte that may end a match */
+			if ((s->flags & DS_START) && re->rev.skip) {
+				if ((j = _rskip(&re->rev, text, i)) == 0) {
+					s = _start(re, d, text[0] == '\n');
+					break;
+				}
+				if (j < i)
+					s = _start(re, d, text[j] == '\n');
+				i = j;
+			}
+
+			c = text[i - 1];
+			at = pos - k + i;
+			if (at < off && (s->flags & DS_ACCEPT) && _accept(s, c))
+				return at;
+			s = STEP(re, d, s, c);
+		}
+	}
+
+	if (off > 0 && (s->flags & DS_ACCEPT) && _accept(s, EOF))
+		return 0;
+	return -1;
+}
+
+/*
+ * Returns the first offset from (bound) on where a match that ends at
+ * or after (end) may begin.
+ */
+static size_t
+_prefix(TxtBuffer *b, TxtRegex *re, size_t end, size_t bound)
+{
+	struct rdfa *d;
+	struct dstate *s;
+	size_t pos, i, k, lo, from;
+	char *text;
+	unsigned char c;
+
+	d = &re->prefix;
+	s = _start(re, d, 0);
+	from = end;
+	for (pos = end; pos > bound && (k = ebrspan(b, pos, &text)) > 0;
+	    pos -= k) {
+		lo = k > pos - bound ? k - (pos - bound) : 0;
+		for (i = k; i > lo; i--) {
+			c = text[i - 1];
+			if ((s->flags & DS_ACCEPT) && _accept(s, c))
+				from = pos - k + i;
+			s = STEP(re, d, s, c);
+			if (s->flags & DS_DEAD)
+				return from;
+		}
+	}
+
+	if ((s->flags & DS_ACCEPT) &&
+	    _accept(s, bound > 0 ? _byte(b, bound - 1) : EOF))
+		from = bound;
+	return from;
+}
+
+/*
+ * Simulates the NFA from (from), where no match that ends later than
+ * any other begins earlier. Returns the offset where the leftmost
+ * match begins once no thread that began before it is left.
+ */
+static size_t
+_leftmost(TxtBuffer *b, TxtRegex *re, size_t from)
+{
+	struct rnfa *nfa;
+	struct rthread *t, *list;
+	size_t p, i, nc, nn, begin, end;
+	int c, found, prevnl;
+
+	nfa = &re->fwd;
+	found = 0;
+	begin = end = 0;
+	nc = 0;
+	prevnl = from == 0 || _byte(b, from - 1) == '\n';
+	ebseek(b, from);
+	re->gen++;
+	for (p = from; ; p++) {
+		c = ebget(b);
+		if (!found)
+			_thread(re, re->clist, &nc, nfa->start, p,
+			    prevnl ? NL_PREV : 0);
+
+		/* What comes next is known for the $ assertions */
+		if (c == '\n' || c == EOF) {
+			re->gen++;
+			for (i = nn = 0; i < nc; i++) {
+				t = &re->clist[i];
+				_thread(re, re->nlist, &nn, t->node, t->start,
+				    (prevnl ? NL_PREV : 0) | NL_NEXT);
+			}
+			list = re->clist;
+			re->clist = re->nlist;
+			re->nlist = list;
+			nc = nn;
+		}
+
+		/* Threads are in the order they began */
+		for (i = 0; i < nc; i++) {
+			t = &re->clist[i];
+			if (nfa->node[t->node].type != RN_MATCH)
+				continue;
+			if (!found || t->start < begin ||
+			    (t->start == begin && p > end)) {
+				begin = t->start;
+				end = p;
+				found = 1;
+			}
+			break;
+		}
+		if (found) {
+			for (i = 0; i < nc && re->clist[i].start <= begin; i++)
+				;
+			nc = i;
+			if (nc == 0 || re->clist[0].start >= begin)
+				return begin;
+		}
+		if (c == EOF)
+			break;
+
+		re->gen++;
+		for (i = nn = 0; i < nc; i++) {
+			t = &re->clist[i];
+			if (nfa->node[t->node].type == RN_BYTES &&
+			    ISSET(nfa->node[t->node].set, c))
+				_thread(re, re->nlist, &nn,
+				    nfa->node[t->node].out, t->start,
+				    c == '\n' ? NL_PREV : 0);
+		}
+		list = re->clist;
+		re->clist = re->nlist;
+		re->nlist = list;
+		nc = nn;
+		prevnl = c == '\n';
+	}
+
+	return begin;
+}
+
+/*
+ * Returns the offset where the longest match that begins at (begin)
+ * ends.
+ */
+static size_t
+_longest(TxtBuffer *b, TxtRegex *re, size_t begin)
+{
+	struct rdfa *d;
+	struct dstate *s;
+	size_t pos, i, k, end;
+	char *text;
+	unsigned char c;
+
+	d = &re->longest;
+	s = _start(re, d, begin == 0 || _byte(b, begin - 1) == '\n');
+	end = begin;
+	for (pos = begin; (k = ebspan(b, pos, &text)) > 0; pos += k) {
+		for (i = 0; i < k; i++) {
+			c = text[i];
+			if ((s->flags & DS_ACCEPT) && _accept(s, c))
+				end = pos + i;
+			s = STEP(re, d, s, c);
+			if (s->flags & DS_DEAD)
+				return end;
+		}
+	}
+
+	if ((s->flags & DS_ACCEPT) && _accept(s, EOF))
+		end = pos;
+	return end;
+}
+
+/*
+ * Returns the index of the first byte from (i) to (k) of (text) that
+ * may begin a match of (nfa), or (k).
+ */
+static size_t
+_skip(struct rnfa *nfa, const char *text, size_t i, size_t k)
+{
+	const char *p;
+
+	if (nfa->first != -1) {
+		p = memchr(&text[i], nfa->first, k - i);
+		return p != NULL ? (size_t) (p - text) : k;
+	}
+	while (i < k && !ISSET(nfa->lead, (unsigned char) text[i]))
+		i++;
+	return i;
+}
+
+/*
+ * Returns the index after the last byte before (i) of (text) that may
+ * begin a match of reversed (nfa), or 0.
+ */
+static size_t
+_rskip(struct rnfa *nfa, const char *text, size_t i)
+{
+	const char *p;
+
+	if (nfa->first != -1) {
+		p = memrchr(text, nfa->first, i);
+		return p != NULL ? (size_t) (p - text) + 1 : 0;
+	}
+	while (i > 0 && !ISSET(nfa->lead, (unsigned char) text[i - 1]))
+		i--;
+	return i;
+}
+
+static int
+_byte(TxtBuffer *b, size_t off)
+{
+	ebseek(b, off);
+	return ebget(b);
+}
+
+/*
+ * Returns non-zero if a match ends in state (s) when (c) comes next.
+ */
+static int
+_accept(struct dstate *s, int c)
+{
+	return (s->flags & DS_MATCH) || c == '\n' || c == EOF;
+}
+
+/*
+ * Adds a thread that began at (start) in (node) to (list) of (n)
+ * threads, following the empty transitions like _closure().
+ */
+static void
+_thread(TxtRegex *re, struct rthread *list, size_t *n, int node,
+    size_t start, int nl)
+{
+	struct rnode *np;
+	size_t sp;
+
+	sp = 0;
+	re->stack[sp++] = node;
+	while (sp > 0) {
+		node = re->stack[--sp];
+		if (re->mark[node] == re->gen)
+			continue;
+		re->mark[node] = re->gen;
+
+		np = &re->fwd.node[node];
+		switch (np->type) {
+		case RN_SPLIT:
+			re->stack[sp++] = np->out1;
+			re->stack[sp++] = np->out;
+			break;
+		case RN_PREV:
+			if (nl & NL_PREV)
+				re->stack[sp++] = np->out;
+			break;
+		case RN_NEXT:
+			if (nl & NL_NEXT) {
+				re->stack[sp++] = np->out;
+				break;
+			}
+			/* FALLTHROUGH */
+		default:
+			list[*n].node = node;
+			list[*n].start = start;
+			(*n)++;
+			break;
+		}
+	}
+}
+
+/*
+ * Returns the state of (d) before anything, after a newline if
+ * (prevnl) is non-zero.
+ */
+static struct dstate *
+_start(TxtRegex *re, struct rdfa *d, int prevnl)
+{
+	struct dstate *s;
+	struct rnfa *nfa;
+	size_t i, n;
+
+	if ((s = d->start[prevnl]) != NULL)
+		return s;
+
+	nfa = d->nfa;
+	re->gen++;
+	n = 0;
+	if (d->mode == RD_ALL) {
+		for (i = 0; i < nfa->n; i++)
+			if (nfa->node[i].type != RN_SPLIT &&
+			    nfa->node[i].type != RN_PREV)
+				re->set[n++] = i;
+	} else {
+		_closure(re, nfa, nfa->start, prevnl ? NL_PREV : 0, re->set,
+		    &n);
+		qsort(re->set, n, sizeof(int), _cmp);
+	}
+
+	s = _state(re, d, re->set, n, prevnl ? DS_PREVNL : 0);
+	s->flags |= DS_START;
+	d->start[prevnl] = s;
+	return s;
+}
+
+/*
+ * Returns the state (s) of (d) leads to with byte (c).
+ */
+static struct dstate *
+_step(TxtRegex *re, struct rdfa *d, struct dstate *s, int c)
+{
+	struct dstate *ns;
+	struct rnfa *nfa;
+	struct rnode *np;
+	size_t i, n, ne, flushes;
+	int prevnl;
+
+	nfa = d->nfa;
+	prevnl = c == '\n';
+	flushes = d->flushes;
+
+	/* The $ assertions hold before a newline */
+	ne = 0;
+	if (c == '\n') {
+		re->gen++;
+		for (i = 0; i < s->n; i++)
+			if (nfa->node[s->set[i]].type == RN_NEXT)
+				_closure(re, nfa, s->set[i], NL_NEXT |
+				    (s->flags & DS_PREVNL ? NL_PREV : 0),
+				    re->tmp, &ne);
+	}
+
+	re->gen++;
+	n = 0;
+	for (i = 0; i < s->n + ne; i++) {
+		np = &nfa->node[i < s->n ? s->set[i] : re->tmp[i - s->n]];
+		if (np->type == RN_BYTES && ISSET(np->set, c))
+			_closure(re, nfa, np->out, prevnl ? NL_PREV : 0,
+			    re->set, &n);
+	}
+	if (d->mode == RD_UNANCHORED)
+		_closure(re, nfa, nfa->start, prevnl ? NL_PREV : 0, re->set,
+		    &n);
+	qsort(re->set, n, sizeof(int), _cmp);
+
+	ns = _state(re, d, re->set, n, prevnl ? DS_PREVNL : 0);
+	if (d->flushes == flushes)
+		s->next[re->class[c]] = ns;
+	return ns;
+}
+
+/*
+ * Returns the state of (d) for the (n) sorted NFA nodes in (set),
+ * which is created unless cached. The cache is flushed once it has
+ * grown too large, along with every state returned before.
+ */
+static struct dstate *
+_state(TxtRegex *re, struct rdfa *d, int *set, size_t n, int flags)
+{
+	struct dstate *s, *next, **table;
+	struct rnfa *nfa;
+	uint64_t h;
+	size_t i, size, ne;
+
+	h = 0xcbf29ce484222325ULL ^ flags;
+	for (i = 0; i < n; i++)
+		h = (h ^ (unsigned int) set[i]) * 0x100000001b3ULL;
+
+	if (d->size > 0)
+		for (s = d->table[h & (d->size - 1)]; s != NULL;
+		    s = s->hnext)
+			if (s->hash == h && s->n == n &&
+			    (s->flags & DS_PREVNL) == flags &&
+			    memcmp(s->set, set, n * sizeof(int)) == 0)
+				return s;
+
+	size = sizeof(*s) + re->nclass * sizeof(s) + n * sizeof(int);
+	if (d->mem + size > EB_REGEXMEM)
+		_flush(d);
+	if (d->nstates >= d->size) {
+		size_t nsize = d->size > 0 ? d->size * 2 : 256;
+
+		if ((table = calloc(nsize, sizeof(*table))) == NULL)
+			err(1, "making space for regex");
+		for (i = 0; i < d->size; i++)
+			for (s = d->table[i]; s != NULL; s = next) {
+				next = s->hnext;
+				s->hnext = table[s->hash & (nsize - 1)];
+				table[s->hash & (nsize - 1)] = s;
+			}
+		free(d->table);
+		d->table = table;
+		d->mem += (nsize - d->size) * sizeof(*table);
+		d->size = nsize;
+	}
+
+	if ((s = calloc(1, size)) == NULL)
+		err(1, "making space for regex");
+	s->hash = h;
+	s->flags = flags;
+	s->set = (int *) &s->next[re->nclass];
+	s->n = n;
+	memcpy(s->set, set, n * sizeof(int));
+
+	nfa = d->nfa;
+	re->gen++;
+	ne = 0;
+	for (i = 0; i < n; i++) {
+		if (nfa->node[set[i]].type == RN_MATCH)
+			s->flags |= DS_MATCH;
+		else if (nfa->node[set[i]].type == RN_NEXT)
+			_closure(re, nfa, set[i], NL_NEXT |
+			    (flags & DS_PREVNL ? NL_PREV : 0), re->tmp, &ne);
+	}
+	for (i = 0; i < ne; i++)
+		if (nfa->node[re->tmp[i]].type == RN_MATCH)
+			s->flags |= DS_MATCHNEXT;
+	if (n == 0 && d->mode != RD_UNANCHORED)
+		s->flags |= DS_DEAD;
+
+	s->hnext = d->table[h & (d->size - 1)];
+	d->table[h & (d->size - 1)] = s;
+	d->nstates++;
+	d->mem += size;
+
+	return s;
+}
+
+/*
+ * Adds the nodes reachable from (node) without consuming a byte to
+ * (set) of (n) nodes, passing the assertions that (nl) tells hold.
+ */
+static void
+_closure(TxtRegex *re, struct rnfa *nfa, int node, int nl, int *set,
+    size_t *n)
+{
+	struct rnode *np;
+	size_t sp;
+
+	sp = 0;
+	re->stack[sp++] = node;
+	while (sp > 0) {
+		node = re->stack[--sp];
+		if (re->mark[node] == re->gen)
+			continue;
+		re->mark[node] = re->gen;
+
+		np = &nfa->node[node];
+		switch (np->type) {
+		case RN_SPLIT:
+			re->stack[sp++] = np->out1;
+			re->stack[sp++] = np->out;
+			break;
+		case RN_PREV:
+			if (nl & NL_PREV)
+				re->stack[sp++] = np->out;
+			break;
+		case RN_NEXT:
+			if (nl & NL_NEXT) {
+				re->stack[sp++] = np->out;
+				break;
+			}
+			/* FALLTHROUGH */
+		default:
+			set[(*n)++] = node;
+			break;
+		}
+	}
+}
+
+static void
+_flush(struct rdfa *d)
+{
+	struct dstate *s, *next;
+	size_t i;
+
+	for (i = 0; i < d->size; i++) {
+		for (s = d->table[i]; s != NULL; s = next) {
+			next = s->hnext;
+			free(s);
+		}
+		d->table[i] = NULL;
+	}
+	d->start[0] = d->start[1] = NULL;
+	d->nstates = 0;
+	d->mem = d->size * sizeof(*d->table);
+	d->flushes++;
+}
+
+static int
+_cmp(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * Parses alternatives. Returns the index of the AST node or -1 on
+ * error, like the rest of the parser.
+ */
+static int
+_alt(struct parse *ps)
+{
+	int l, r;
+
+	if ((l = _cat(ps)) == -1)
+		return -1;
+	while (*ps->p == '|') {
+		ps->p++;
+		if ((r = _cat(ps)) == -1)
+			return -1;
+		l = _ast(ps, RA_ALT, l, r);
+	}
+
+	return l;
+}
+
+static int
+_cat(struct parse *ps)
+{
+	int l, r;
+
+	l = _ast(ps, RA_EMPTY, -1, -1);
+	while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+		if ((r = _repeat(ps)) == -1)
+			return -1;
+		l = _ast(ps, RA_CAT, l, r);
+	}
+
+	return l;
+}
+
+static int
+_repeat(struct parse *ps)
+{
+	int i, min, max;
+
+	if ((i = _atom(ps)) == -1)
+		return -1;
+	for (;;) {
+		switch (*ps->p) {
+		case '*':
+			min = 0;
+			max = -1;
+			break;
+		case '+':
+			min = 1;
+			max = -1;
+			break;
+		case '?':
+			min = 0;
+			max = 1;
+			break;
+		case '{':
+			ps->p++;
+			if (_count(ps, &min) == -1)
+				return -1;
+			max = min;
+			if (*ps->p == ',') {
+				ps->p++;
+				max = -1;
+				if (*ps->p != '}' && _count(ps, &max) == -1)
+					return -1;
+			}
+			if (*ps->p != '}' || (max != -1 && max < min))
+				return -1;
+			break;
+		default:
+			return i;
+		}
+		ps->p++;
+		i = _ast(ps, RA_REPEAT, i, -1);
+		ps->ast[i].min = min;
+		ps->ast[i].max = max;
+	}
+}
+
+static int
+_atom(struct parse *ps)
+{
+	unsigned char set[32];
+	int i, r;
+
+	memset(set, 0, sizeof(set));
+	switch (*ps->p) {
+	case '(':
+		ps->p++;
+		if ((i = _alt(ps)) == -1 || *ps->p != ')')
+			return -1;
+		ps->p++;
+		return i;
+	case '[':
+		ps->p++;
+		if (_class(ps, set) == -1)
+			return -1;
+		return _set(ps, set);
+	case '.':
+		/* A byte but a newline or continuation, and those after */
+		ps->p++;
+		memset(set, 0xff, sizeof(set));
+		memset(&set[0x80 >> 3], 0, (0xC0 - 0x80) >> 3);
+		set['\n' >> 3] &= ~(1 << ('\n' & 7));
+		i = _set(ps, set);
+		memset(set, 0, sizeof(set));
+		memset(&set[0x80 >> 3], 0xff, (0xC0 - 0x80) >> 3);
+		r = _ast(ps, RA_REPEAT, _set(ps, set), -1);
+		ps->ast[r].min = 0;
+		ps->ast[r].max = -1;
+		return _ast(ps, RA_CAT, i, r);
+	case '^':
+		ps->p++;
+		return _ast(ps, RA_BOL, -1, -1);
+	case '$':
+		ps->p++;
+		return _ast(ps, RA_EOL, -1, -1);
+	case '\\':
+		ps->p++;
+		if (_escape(ps, set) == -1)
+			return -1;
+		_fold(ps, set);
+		return _set(ps, set);
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+	case ')':
+	case '\0':
+		return -1;
+	default:
+		ADDSET(set, (unsigned char) *ps->p);
+		ps->p++;
+		_fold(ps, set);
+		return _set(ps, set);
+	}
+}
+
+/*
+ * Parses a bracket expression to (set).
+ */
+static int
+_class(struct parse *ps, unsigned char *set)
+{
+	unsigned char item[32];
+	int c, lo, hi, neg, first;
+	size_t i;
+
+	neg = 0;
+	if (*ps->p == '^') {
+		neg = 1;
+		ps->p++;
+	}
+	for (first = 1; *ps->p != ']' || first; first = 0) {
+		if (*ps->p == '\0')
+			return -1;
+		if (*ps->p == '\\') {
+			ps->p++;
+			memset(item, 0, sizeof(item));
+			if (_escape(ps, item) == -1)
+				return -1;
+			for (i = 0; i < sizeof(item); i++)
+				set[i] |= item[i];
+			continue;
+		}
+
+		lo = hi = (unsigned char) *ps->p++;
+		if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+			hi = (unsigned char) ps->p[1];
+			ps->p += 2;
+			if (hi < lo)
+				return -1;
+		}
+		for (c = lo; c <= hi; c++)
+			ADDSET(set, c);
+	}
+	ps->p++;
+
+	_fold(ps, set);
+	if (neg) {
+		for (i = 0; i < 32; i++)
+			set[i] = ~set[i];
+		set['\n' >> 3] &= ~(1 << ('\n' & 7));
+	}
+	return 0;
+}
+
+/*
+ * Parses the escape after a backslash to (set).
+ */
+static int
+_escape(struct parse *ps, unsigned char *set)
+{
+	const char *s;
+	int c, neg;
+	size_t i;
+
+	neg = 0;
+	switch ((c = (unsigned char) *ps->p++)) {
+	case '\0':
+		return -1;
+	case 'n':
+		ADDSET(set, '\n');
+		return 0;
+	case 't':
+		ADDSET(set, '\t');
+		return 0;
+	case 'r':
+		ADDSET(set, '\r');
+		return 0;
+	case 'D':
+	case 'W':
+	case 'S':
+		neg = 1;
+		/* FALLTHROUGH */
+	case 'd':
+	case 'w':
+	case 's':
+		break;
+	default:
+		if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+		    (c >= 'a' && c <= 'z'))
+			return -1;
+		ADDSET(set, c);
+		return 0;
+	}
+
+	switch (c | 0x20) {
+	case 'd':
+		for (c = '0'; c <= '9'; c++)
+			ADDSET(set, c);
+		break;
+	case 'w':
+		for (c = 0; c < 128; c++)
+			if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+			    (c >= 'a' && c <= 'z') || c == '_')
+				ADDSET(set, c);
+		break;
+	case 's':
+		for (s = " \t\n\r\f\v"; *s != '\0'; s++)
+			ADDSET(set, *s);
+		break;
+	}
+	if (neg) {
+		for (i = 0; i < 32; i++)
+			set[i] = ~set[i];
+		set['\n' >> 3] &= ~(1 << ('\n' & 7));
+	}
+	return 0;
+}
+
+/*
+ * Parses the count of r{m,n} to (n).
+ */
+static int
+_count(struct parse *ps, int *n)
+{
+	if (*ps->p < '0' || *ps->p > '9')
+		return -1;
+	for (*n = 0; *ps->p >= '0' && *ps->p <= '9'; ps->p++)
+		if ((*n = *n * 10 + *ps->p - '0') > EB_REGEXREP)
+			return -1;
+	return 0;
+}
+
+/*
+ * Adds the other case of the ASCII letters in (set) with EBR_ICASE.
+ */
+static void
+_fold(struct parse *ps, unsigned char *set)
+{
+	int c;
+
+	if (!(ps->flags & EBR_ICASE))
+		return;
+	for (c = 'a'; c <= 'z'; c++)
+		if (ISSET(set, c) || ISSET(set, c - 'a' + 'A')) {
+			ADDSET(set, c);
+			ADDSET(set, c - 'a' + 'A');
+		}
+}
+
+static int
+_ast(struct parse *ps, int type, int l, int r)
+{
+	size_t max;
+
+	if (ps->n == ps->max) {
+		max = ps->max > 0 ? ps->max * 2 : 64;
+		if ((ps->ast = reallocarray(ps->ast, max,
+		    sizeof(struct rast))) == NULL)
+			err(1, "making space for regex");
+		ps->max = max;
+	}
+	memset(&ps->ast[ps->n], 0, sizeof(struct rast));
+	ps->ast[ps->n].type = type;
+	ps->ast[ps->n].l = l;
+	ps->ast[ps->n].r = r;
+
+	return ps->n++;
+}
+
+static int
+_set(struct parse *ps, const unsigned char *set)
+{
+	int i;
+
+	i = _ast(ps, RA_SET, -1, -1);
+	memcpy(ps->ast[i].set, set, sizeof(ps->ast[i].set));
+	return i;
+}
+
+/*
+ * Compiles the AST at (root) to (nfa), reversed if (reverse) is
+ * non-zero. Returns -1 if it has too many nodes.
+ */
+static int
+_compile(struct rnfa *nfa, struct parse *ps, int root, int reverse)
+{
+	int match;
+
+	if ((match = _node(nfa, RN_MATCH, -1, -1)) == -1 ||
+	    (nfa->start = _emit(nfa, ps, root, match, reverse)) == -1)
+		return -1;
+	return 0;
+}
+
+/*
+ * Emits the nodes for AST node (i) followed by NFA node (next).
+ *
+ * Returns the node to begin with or -1 if there are too many nodes.
+ */
+static int
+_emit(struct rnfa *nfa, struct parse *ps, int i, int next, int reverse)
+{
+	struct rast *a;
+	int n, l, r, s, tail, k, count;
+
+	a = &ps->ast[i];
+	switch (a->type) {
+	case RA_SET:
+		if ((n = _node(nfa, RN_BYTES, next, -1)) != -1)
+			memcpy(nfa->node[n].set, a->set, sizeof(a->set));
+		return n;
+	case RA_CAT:
+		if ((n = _emit(nfa, ps, reverse ? a->l : a->r, next,
+		    reverse)) == -1)
+			return -1;
+		return _emit(nfa, ps, reverse ? a->r : a->l, n, reverse);
+	case RA_ALT:
+		if ((l = _emit(nfa, ps, a->l, next, reverse)) == -1 ||
+		    (r = _emit(nfa, ps, a->r, next, reverse)) == -1)
+			return -1;
+		return _node(nfa, RN_SPLIT, l, r);
+	case RA_REPEAT:
+		if (a->max == -1) {
+			/* Loop back to a split before the last one */
+			if ((s = _node(nfa, RN_SPLIT, -1, next)) == -1 ||
+			    (n = _emit(nfa, ps, a->l, s, reverse)) == -1)
+				return -1;
+			nfa->node[s].out = n;
+			tail = a->min > 0 ? n : s;
+			count = a->min > 0 ? a->min - 1 : 0;
+		} else {
+			/* Optional ones nested, (r(r)?)? */
+			for (tail = next, k = a->min; k < a->max; k++)
+				if ((n = _emit(nfa, ps, a->l, tail,
+				    reverse)) == -1 ||
+				    (tail = _node(nfa, RN_SPLIT, n,
+				    next)) == -1)
+					return -1;
+			count = a->min;
+		}
+		for (k = 0; k < count; k++)
+			if ((tail = _emit(nfa, ps, a->l, tail, reverse)) == -1)
+				return -1;
+		return tail;
+	case RA_BOL:
+		return _node(nfa, reverse ? RN_NEXT : RN_PREV, next, -1);
+	case RA_EOL:
+		return _node(nfa, reverse ? RN_PREV : RN_NEXT, next, -1);
+	default:
+		return next;
+	}
+}
+
+static int
+_node(struct rnfa *nfa, int type, int out, int out1)
+{
+	size_t max;
+
+	if (nfa->n == EB_REGEXNODES)
+		return -1;
+	if (nfa->n == nfa->max) {
+		max = nfa->max > 0 ? nfa->max * 2 : 64;
+		if ((nfa->node = reallocarray(nfa->node, max,
+		    sizeof(struct rnode))) == NULL)
+			err(1, "making space for regex");
+		nfa->max = max;
+	}
+	memset(&nfa->node[nfa->n], 0, sizeof(struct rnode));
+	nfa->node[nfa->n].type = type;
+	nfa->node[nfa->n].out = out;
+	nfa->node[nfa->n].out1 = out1;
+
+	return nfa->n++;
+}
+
+/*
+ * Finds the bytes that matches of (nfa) may begin with, and the byte
+ * that they all begin with if there is one.
+ */
+static void
+_lead(TxtRegex *re, struct rnfa *nfa)
+{
+	struct rnode *np;
+	size_t i, n;
+	int c;
+
+	re->gen++;
+	n = 0;
+	_closure(re, nfa, nfa->start, NL_PREV | NL_NEXT, re->set, &n);
+
+	/* An empty match may be anywhere */
+	memset(nfa->lead, 0, sizeof(nfa->lead));
+	for (i = 0; i < n; i++) {
+		np = &nfa->node[re->set[i]];
+		if (np->type != RN_BYTES) {
+			memset(nfa->lead, 0xff, sizeof(nfa->lead));
+			break;
+		}
+		for (c = 0; c < 32; c++)
+			nfa->lead[c] |= np->set[c];
+	}
+
+	nfa->first = -1;
+	for (c = 0, n = 0; c < 256; c++)
+		if (ISSET(nfa->lead, c)) {
+			nfa->first = c;
+			n++;
+		}
+	nfa->skip = n < 256;
+	if (n != 1)
+		nfa->first = -1;
+}
+
+/*
+ * Divides the bytes into classes that no node of the NFA tells apart,
+ * so that the DFA states need a transition for each class only.
+ */
+static void
+_classes(TxtRegex *re)
+{
+	unsigned char nl[32];
+	size_t i;
+
+	memset(re->class, 0, sizeof(re->class));
+	re->nclass = 1;
+
+	memset(nl, 0, sizeof(nl));
+	ADDSET(nl, '\n');
+	_refine(re, nl);
+	for (i = 0; i < re->fwd.n; i++)
+		if (re->fwd.node[i].type == RN_BYTES)
+			_refine(re, re->fwd.node[i].set);
+}
+
+static void
+_refine(TxtRegex *re, const unsigned char *set)
+{
+	int id[256 * 2];
+	int c, key, n;
+
+	for (key = 0; key < 256 * 2; key++)
+		id[key] = -1;
+	n = 0;
+	for (c = 0; c < 256; c++) {
+		key = re->class[c] * 2 + (ISSET(set, c) != 0);
+		if (id[key] == -1)
+			id[key] = n++;
+		re->class[c] = id[key];
+	}
+	re->nclass = n;
+}
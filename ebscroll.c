@@ -16,13 +16,77 @@
  */
 
 #include "editbuffer.h"
+#include <limits.h>
+
+/*
+ * Soft-wrap layout cache. Every block remembers how many visual rows
+ * start within it for the wrap width and start column it was last laid
+ * out with, and the column it ends at.
+ *
+ * A row starts at the beginning of the buffer, after a newline and
+ * where the next character would not fit within the wrap width.
+ * Characters take as many columns as in ebcolumn, which are counted at
+ * the first byte of the character even if the rest of it is in the
+ * next block. A block whose layout looked at the edges of its
+ * neighbours is marked, so that modifying or relinking them makes it
+ * stale.
+ *
+ * The row counts and lengths of the blocks are kept in Fenwick trees
+ * for the width last scrolled with, so that finding the block of a
+ * position or of a row takes logarithmic time and only that block is
+ * scanned. Edits mark the blocks they touched, which are laid out
+ * again on the next scroll together with the blocks after them until
+ * the start column matches again. Adding or removing blocks rebuilds
+ * the index, which lays out only the blocks whose layout is stale.
+ */
+
+#define LINESTART	UINT_MAX	/* Column before a line, see _scan */
+
+#define EB_ROWDIRTY	16	/* Edits to remember before a rebuild */
+#define EB_ROWNEAR	3	/* Bytes a layout looks past its block */
+
+#define EXACT(x, w, col)	\
+	(((x)->flags & EBF_LAYOUT) && (x)->rwidth == (w) && (x)->rscol == (col))
+
+struct txt_rows {
+	unsigned int width;	/* Wrap width of the layout */
+	size_t version;		/* Buffer version seen last */
+	size_t shape;		/* Block list the index is for */
+	int valid;
+	size_t n;		/* Blocks */
+	size_t max;
+	TxtBlock **blk;		/* Blocks in buffer order */
+	size_t *len;		/* Lengths of the blocks */
+	size_t *rows;		/* Row starts of the blocks */
+	size_t *lentree;	/* Fenwick trees of the above */
+	size_t *rowtree;
+	struct txt_rowdirty {
+		size_t lo;	/* First block touched by an edit */
+		size_t hi;	/* Last block touched by it */
+	} dirty[EB_ROWDIRTY];
+	size_t ndirty;
+};
+
+static size_t	_scan(TxtBuffer *, TxtBlock *, size_t, size_t,
+		    unsigned int *, unsigned int, size_t, size_t *);
+static size_t	_need(TxtBuffer *, TxtBlock *, size_t);
+static unsigned int _seqwidth(TxtBuffer *, TxtBlock *, size_t,
+		    unsigned int, size_t *);
+static void	_peek(TxtBlock *, TxtBlock *);
+static void	_layout(TxtBuffer *, TxtBlock *, unsigned int, unsigned int);
+static TxtRows	*_index(TxtBuffer *, unsigned int);
+static void	_build(TxtBuffer *, TxtRows *, unsigned int);
+static void	_refresh(TxtBuffer *, TxtRows *);
+static void	_add(size_t *, size_t, size_t, size_t);
+static size_t	_sum(size_t *, size_t);
+static size_t	_find(size_t *, size_t, size_t *);
 
 /*
  * Returns cursor index after scrolling buffer a number of lines (n)
  * from source cursor index (pos).
  */
-int
-ebscroll(TxtBuffer *b, int pos, int n)
+size_t
+ebscroll(TxtBuffer *b, size_t pos, ssize_t n)
 {
 	if (n > 0)
 		while (n--)
@@ -33,3 +97,440 @@ ebscroll(TxtBuffer *b, int pos, int n)
 
 	return pos;
 }
+
+/*
+ * Returns the beginning of the visual row (n) rows below or above the
+ * row containing (pos) when lines of buffer (b) are wrapped to (width)
+ * columns. Zero width does not wrap. Scrolling past the end returns
+ * the end of the buffer.
+ */
+size_t
+ebscrollrows(TxtBuffer *b, size_t pos, ssize_t n, size_t width)
+{
+	TxtRows *r;
+	TxtBlock *np;
+	unsigned int col;
+	size_t total, row, j, p, at;
+
+	if (width > UINT_MAX / 2)
+		width = 0;
+	r = _index(b, width);
+
+	total = _sum(r->rowtree, r->n);
+	if (pos >= b->len) {
+		/* End of buffer right after a newline starts a row */
+		row = total;
+		if (r->n > 0 && r->blk[r->n - 1]->recol != LINESTART)
+			row--;
+	} else {
+		p = pos;
+		j = _find(r->lentree, r->n, &p);
+		np = r->blk[j];
+		col = np->rscol;
+		row = _sum(r->rowtree, j) +
+		    _scan(b, np, 0, p + 1, &col, width, 0, NULL) - 1;
+	}
+
+	if (n < 0 && (size_t)-n > row)
+		return 0;
+	row += n;
+	if (row >= total)
+		return b->len;
+
+	j = _find(r->rowtree, r->n, &row);
+	np = r->blk[j];
+	col = np->rscol;
+	_scan(b, np, 0, np->len, &col, width, row + 1, &at);
+
+	return _sum(r->lentree, j) + at;
+}
+
+/*
+ * Returns the row index of (b) for (width), brought up to date.
+ */
+static TxtRows *
+_index(TxtBuffer *b, unsigned int width)
+{
+	TxtRows *r;
+
+	if ((r = b->rows) == NULL) {
+		if ((r = calloc(1, sizeof(TxtRows))) == NULL)
+			err(1, "making space for rows");
+		b->rows = r;
+	}
+
+	if (!r->valid || r->width != width || r->shape != b->shape ||
+	    r->version != b->version)
+		_build(b, r, width);
+	else if (r->ndirty > 0)
+		_refresh(b, r);
+
+	return r;
+}
+
+/*
+ * Lays out the blocks of (b) whose layout is stale and indexes all of
+ * them.
+ */
+static void
+_build(TxtBuffer *b, TxtRows *r, unsigned int width)
+{
+	TxtBlock *np;
+	unsigned int col;
+	size_t i, n, k;
+
+	for (n = 0, np = eb_first(b); np != NULL; np = np->next)
+		n++;
+
+	if (n + 1 > r->max) {
+		r->max = n + 1;
+		if ((r->blk = reallocarray(r->blk, r->max,
+		    sizeof(TxtBlock *))) == NULL ||
+		    (r->len = reallocarray(r->len, r->max,
+		    sizeof(size_t))) == NULL ||
+		    (r->rows = reallocarray(r->rows, r->max,
+		    sizeof(size_t))) == NULL ||
+		    (r->lentree = reallocarray(r->lentree, r->max,
+		    sizeof(size_t))) == NULL ||
+		    (r->rowtree = reallocarray(r->rowtree, r->max,
+		    sizeof(size_t))) == NULL)
+			err(1, "making space for rows");
+	}
+
+	col = LINESTART;
+	for (i = 0, np = eb_first(b); np != NULL; i++, np = np->next) {
+		if (!EXACT(np, width, col))
+			_layout(b, np, col, width);
+		col = np->recol;
+		r->blk[i] = np;
+		r->len[i] = r->lentree[i + 1] = np->len;
+		r->rows[i] = r->rowtree[i + 1] = np->rows;
+	}
+
+	/* Each node adds itself to its parent */
+	for (i = 1; i <= n; i++) {
+		if ((k = i + (i & -i)) <= n) {
+			r->lentree[k] += r->lentree[i];
+			r->rowtree[k] += r->rowtree[i];
+		}
+	}
+
+	r->n = n;
+	r->width = width;
+	r->version = b->version;
+	r->shape = b->shape;
+	r->ndirty = 0;
+	r->valid = 1;
+}
+
+/*
+ * Lays out again the blocks touched by edits since the index was last
+ * used, and the blocks after them until one starts at the column it
+ * was laid out with. Blocks within EB_ROWNEAR bytes of an edit are
+ * laid out regardless, as their layout may have looked at it.
+ */
+static void
+_refresh(TxtBuffer *b, TxtRows *r)
+{
+	struct txt_rowdirty d;
+	TxtBlock *np;
+	unsigned int col;
+	size_t i, k, lo, hi, near;
+
+	/* In buffer order, so that each starts after exact blocks */
+	for (i = 1; i < r->ndirty; i++) {
+		d = r->dirty[i];
+		for (k = i; k > 0 && r->dirty[k - 1].lo > d.lo; k--)
+			r->dirty[k] = r->dirty[k - 1];
+		r->dirty[k] = d;
+	}
+
+	for (i = 0; i < r->ndirty; i++) {
+		for (lo = r->dirty[i].lo, near = 0;
+		    lo > 0 && near < EB_ROWNEAR; near += r->len[lo])
+			lo--;
+		for (hi = r->dirty[i].hi, near = 0;
+		    hi + 1 < r->n && near < EB_ROWNEAR; near += r->len[hi])
+			hi++;
+
+		col = r->blk[lo]->rscol;
+		for (k = lo; k < r->n; k++) {
+			np = r->blk[k];
+			if (k > hi && EXACT(np, r->width, col))
+				break;
+			_layout(b, np, col, r->width);
+			if (np->rows != r->rows[k]) {
+				_add(r->rowtree, r->n, k,
+				    np->rows - r->rows[k]);
+				r->rows[k] = np->rows;
+			}
+			col = np->recol;
+		}
+	}
+	r->ndirty = 0;
+}
+
+/*
+ * Notes that (oldlen) bytes at (off) of (b) were replaced with (newlen)
+ * bytes. Edits that add or remove blocks leave the index to be rebuilt.
+ */
+void
+eb_rowchanged(TxtBuffer *b, size_t off, size_t oldlen, size_t newlen)
+{
+	TxtRows *r;
+	size_t j, so, x;
+
+	r = b->rows;
+	if (!r->valid || r->shape != b->shape ||
+	    r->version + 1 != b->version || r->ndirty == EB_ROWDIRTY) {
+		r->valid = 0;
+		return;
+	}
+	r->version = b->version;
+
+	/* Blocks by their old lengths, from the one before (off) */
+	x = so = off > 0 ? off - 1 : 0;
+	j = _find(r->lentree, r->n, &x);
+	so -= x;
+	if (j == r->n && j == 0) {
+		r->valid = 0;
+		return;
+	}
+	if (j == r->n)
+		so -= r->len[--j];
+	while (j > 0 && r->len[j - 1] == 0)
+		j--;	/* Empty blocks the edit may have filled */
+
+	r->dirty[r->ndirty].lo = j;
+	for (; j < r->n && so <= off + oldlen; j++) {
+		so += r->len[j];
+		if (r->blk[j]->len != r->len[j]) {
+			_add(r->lentree, r->n, j, r->blk[j]->len - r->len[j]);
+			r->len[j] = r->blk[j]->len;
+		}
+	}
+	r->dirty[r->ndirty++].hi = j - 1;
+}
+
+/*
+ * Frees the row index of (b).
+ */
+void
+eb_rowfree(TxtBuffer *b)
+{
+	TxtRows *r;
+
+	if ((r = b->rows) == NULL)
+		return;
+	free(r->blk);
+	free(r->len);
+	free(r->rows);
+	free(r->lentree);
+	free(r->rowtree);
+	free(r);
+	b->rows = NULL;
+}
+
+/*
+ * Adds (delta), which may wrap around, to the (i)th of (n) values in
+ * Fenwick tree (t).
+ */
+static void
+_add(size_t *t, size_t n, size_t i, size_t delta)
+{
+	for (i++; i <= n; i += i & -i)
+		t[i] += delta;
+}
+
+/*
+ * Returns the sum of the first (i) values in Fenwick tree (t).
+ */
+static size_t
+_sum(size_t *t, size_t i)
+{
+	size_t sum;
+
+	for (sum = 0; i > 0; i -= i & -i)
+		sum += t[i];
+
+	return sum;
+}
+
+/*
+ * Returns the index of the value in Fenwick tree (t) of (n) values
+ * that holds the (*x)th unit counting from zero, or (n) if there are
+ * not that many, and subtracts the values before it from (*x).
+ */
+static size_t
+_find(size_t *t, size_t n, size_t *x)
+{
+	size_t pos, step;
+
+	for (step = 1; step * 2 <= n; step *= 2)
+		;
+	for (pos = 0; n > 0 && step > 0; step /= 2) {
+		if (pos + step <= n && t[pos + step] <= *x) {
+			pos += step;
+			*x -= t[pos];
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Lays out block (np) starting at column (col).
+ */
+static void
+_layout(TxtBuffer *b, TxtBlock *np, unsigned int col, unsigned int width)
+{
+	char *text;
+
+	text = EBTEXT(b, np);
+	np->flags &= ~(EBF_LAYOUTNL | EBF_LAYOUTPEEK);
+	if (memchr(text, '\n', np->len) != NULL)
+		np->flags |= EBF_LAYOUTNL;
+
+	np->flags |= EBF_LAYOUT;	/* Unless _peek takes it back */
+	np->rscol = col;
+	np->rows = _scan(b, np, 0, np->len, &col, width, 0, NULL);
+	np->recol = col;
+	np->rwidth = width;
+}
+
+/*
+ * Counts row starts in block (np) between (from) and (to) when starting
+ * at column (*colp), which is updated. Stops at the (stop)th row start
+ * if non-zero and stores its position to (at).
+ *
+ * The column is LINESTART rather than 0 before the first character of
+ * a line, so that a zero width character there does not make the next
+ * one start another row.
+ */
+static size_t
+_scan(TxtBuffer *b, TxtBlock *np, size_t from, size_t to,
+    unsigned int *colp, unsigned int width, size_t stop, size_t *at)
+{
+	unsigned char ch;
+	unsigned int col, x, w;
+	size_t i, n, need;
+	char *text;
+
+	col = *colp;
+	need = _need(b, np, from);
+	text = EBTEXT(b, np);
+	for (i = from, n = 0; i < to; i++) {
+		ch = text[i];
+		if (need > 0 && (ch & 0xC0) == 0x80) {
+			need--;
+			continue;	/* UTF-8 continuation */
+		}
+		need = 0;
+
+		x = col == LINESTART ? 0 : col;
+		if (ch == '\n')
+			w = 0;
+		else if (ch >= 0xC2 && ch < 0xF5) {
+			w = _seqwidth(b, np, i, x, &need);
+			text = EBTEXT(b, np);
+		} else
+			w = eb_colwidth(ch < 0x80 ? ch : 0xFFFD, x);
+
+		if (col == LINESTART || (width > 0 && col + w > width)) {
+			col = 0;
+			if (++n == stop) {
+				*at = i;
+				break;
+			}
+		}
+
+		col += w;
+		if (ch == '\n')
+			col = LINESTART;
+	}
+	*colp = col;
+
+	return n;
+}
+
+/*
+ * Returns the number of UTF-8 continuation bytes still expected at
+ * (from) of block (np), looking back into the previous blocks.
+ */
+static size_t
+_need(TxtBuffer *b, TxtBlock *np, size_t from)
+{
+	TxtBlock *x;
+	unsigned char ch;
+	size_t c, need;
+
+	if (from >= np->len || (EBTEXT(b, np)[from] & 0xC0) != 0x80)
+		return 0;
+
+	for (x = np, c = 0; c < 3; c++) {
+		while (from == 0) {
+			if ((x = x->prev) == NULL)
+				return 0;
+			_peek(np, x);
+			from = x->len;
+		}
+		ch = EBTEXT(b, x)[--from];
+		if ((ch & 0xC0) == 0x80)
+			continue;
+
+		if (ch < 0xC2 || ch >= 0xF5)
+			return 0;
+		need = ch >= 0xF0 ? 3 : ch >= 0xE0 ? 2 : 1;
+		return need > c ? need - c : 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the width of the UTF-8 sequence that starts at (i) of block
+ * (np) at column (col), looking into the next blocks for the rest of
+ * it, and stores the number of continuation bytes it expects to (need).
+ * A truncated sequence takes one column.
+ */
+static unsigned int
+_seqwidth(TxtBuffer *b, TxtBlock *np, size_t i, unsigned int col,
+    size_t *need)
+{
+	TxtBlock *x;
+	unsigned char ch;
+	unsigned int u;
+	size_t k, n;
+
+	ch = EBTEXT(b, np)[i];
+	n = ch >= 0xF0 ? 3 : ch >= 0xE0 ? 2 : 1;
+	u = ch & (0x3F >> n);
+	*need = n;
+
+	for (x = np, k = 0; k < n; k++) {
+		for (i++; i >= x->len; i = 0) {
+			if ((x = x->next) == NULL)
+				return 1;
+			_peek(np, x);
+		}
+		if (((ch = EBTEXT(b, x)[i]) & 0xC0) != 0x80)
+			return 1;
+		u = (u << 6) | (ch & 0x3F);
+	}
+
+	return eb_colwidth(u, col);
+}
+
+/*
+ * Notes that the layout of block (np) looked at the text of block (x).
+ * Only the neighbours make it stale when they change, so looking any
+ * further leaves the layout unknown.
+ */
+static void
+_peek(TxtBlock *np, TxtBlock *x)
+{
+	if (x == np->prev || x == np->next)
+		np->flags |= EBF_LAYOUTPEEK;
+	else
+		np->flags &= ~EBF_LAYOUT;
+}
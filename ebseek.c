@@ -19,7 +19,7 @@
 
 static void _findroot(TxtBlock **root, size_t *offset, size_t target);
 
-int
+size_t
 ebseek(TxtBuffer *buffer, size_t target_offset)
 {
 	if (target_offset > buffer->len)
@@ -42,17 +42,14 @@ ebseek(TxtBuffer *buffer, size_t target_offset)
 static void
 _findroot(TxtBlock **root, size_t *offset, size_t target)
 {
-	int local;
-
 	while (*root != NULL) {
-		local = target - *offset;
-		if (local < 0) {
+		if (target < *offset) {
 			if ((*root)->prev == NULL)
 				break;	/* this is the first node */
 			*root = (*root)->prev;
 			if (*root != NULL)
 				*offset -= (*root)->len;
-		} else if (local >= (*root)->len && (*root)->len > 0 &&
+		} else if (target - *offset >= (*root)->len && (*root)->len > 0 &&
 		    1 /*(*root)->len == TXTBLOCK_MAXLEN*/
 			/*
 			 * last condition was disabled due to problems,
@@ -0,0 +1,278 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Moves text between buffers. The blocks at the edges of the range are
+ * split so that the range consists of whole blocks, which are unlinked
+ * from the source and linked into the destination together with their
+ * text, compressed or not. Only the inline block of the source and
+ * text mapped from a session image are copied, since they do not
+ * belong to the list.
+ */
+
+#include "editbuffer.h"
+#include <errno.h>
+
+static int	 _valid(TxtBuffer *, size_t, TxtBuffer *, size_t, size_t);
+static int	 _copy(TxtBuffer *, size_t, TxtBuffer *, size_t, size_t,
+		    size_t, size_t);
+static size_t	 _copies(TxtBuffer *, size_t, size_t);
+static TxtBlock	*_take(TxtBuffer *, TxtBuffer *, TxtBlock *);
+static void	 _seek(TxtBuffer *, TxtBlock *, size_t, size_t);
+static size_t	 _shift(size_t, size_t, size_t);
+
+/*
+ * Moves (len) bytes at (src_off) of (src) to (dst_off) of (dst). The
+ * cursors stay on the text they were on.
+ *
+ * Returns 0 on success or -1 with errno set to EINVAL if the buffers
+ * are the same or the offsets are out of range, or to ENOMEM if the
+ * memory budget ran out, see ebarena, in which case nothing is changed.
+ */
+int
+ebsplice(TxtBuffer *dst, size_t dst_off, TxtBuffer *src, size_t src_off,
+    size_t len)
+{
+	TxtBlock *first, *last, *end, *np, *next, *prev;
+	size_t dcursor, scursor, n;
+	ssize_t lines;
+
+	if (dst == src || !_valid(dst, dst_off, src, src_off, len)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len == 0)
+		return 0;
+
+	dcursor = dst->offset;
+	scursor = src->offset;
+
+	/*
+	 * Splitting the edges of both buffers and the copies, or what
+	 * ebput and ebdel need for copying less than a block, which is
+	 * not worth splitting blocks for.
+	 */
+	if (len < TXTBLOCK_MAXLEN)
+		n = 5;
+	else
+		n = 3 + _copies(src, src_off, len);
+	if (eb_reserve(dst, n) == -1) {
+		ebseek(src, scursor);
+		return -1;
+	}
+
+	/* Reclaiming may have taken text from either buffer */
+	if (!_valid(dst, dst_off, src, src_off, len)) {
+		ebseek(dst, dcursor);
+		ebseek(src, scursor);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (len < TXTBLOCK_MAXLEN)
+		return _copy(dst, dst_off, src, src_off, len, dcursor,
+		    scursor);
+
+	lines = eb_nlines(src, src_off, len);
+
+	/* Unlink whole blocks from the source */
+	first = eb_cut(src, src_off);
+	end = eb_cut(src, src_off + len);
+	last = end != NULL ? end->prev : src->last;
+	if ((prev = first->prev) != NULL) {
+		prev->next = end;
+		EBRELINKED(prev);
+	}
+	if (end != NULL) {
+		end->prev = prev;
+		EBRELINKED(end);
+	} else
+		src->last = prev;
+	first->prev = last->next = NULL;
+	src->len -= len;
+	_seek(src, prev != NULL ? prev : end,
+	    prev != NULL ? src_off - prev->len : 0,
+	    _shift(scursor, src_off, len));
+
+	/* Hand over their text */
+	for (np = first; np != NULL; np = next) {
+		next = np->next;
+		np = _take(dst, src, np);
+		if (np->prev == NULL)
+			first = np;
+		last = np;
+	}
+
+	/* Link them into the destination */
+	end = eb_cut(dst, dst_off);
+	prev = end != NULL ? end->prev : dst->last;
+	first->prev = prev;
+	if (prev != NULL) {
+		prev->next = first;
+		EBRELINKED(prev);
+	}
+	last->next = end;
+	if (end != NULL) {
+		end->prev = last;
+		EBRELINKED(end);
+	} else
+		dst->last = last;
+	EBRELINKED(first);
+	EBRELINKED(last);
+	dst->len += len;
+	_seek(dst, first, dst_off, dcursor > dst_off ? dcursor + len : dcursor);
+
+	eb_changed(src, src_off, len, 0, -lines);
+	eb_changed(dst, dst_off, 0, len, lines);
+
+	return 0;
+}
+
+static int
+_valid(TxtBuffer *dst, size_t dst_off, TxtBuffer *src, size_t src_off,
+    size_t len)
+{
+	return dst_off <= dst->len && src_off <= src->len &&
+	    len <= src->len - src_off;
+}
+
+/*
+ * Moves the text by copying it, which ebput and ebdel also report.
+ * The cursors were at (dcursor) and (scursor).
+ */
+static int
+_copy(TxtBuffer *dst, size_t dst_off, TxtBuffer *src, size_t src_off,
+    size_t len, size_t dcursor, size_t scursor)
+{
+	char s[TXTBLOCK_MAXLEN];
+	size_t k, n;
+
+	for (n = 0; n < len; n += k) {
+		ebseek(src, src_off + n);
+		k = src->root->len - LOCAL_OFFSET(src);
+		if (k > len - n)
+			k = len - n;
+		memcpy(&s[n], &EBTEXT(src, src->root)[LOCAL_OFFSET(src)], k);
+	}
+
+	ebseek(src, scursor);
+	ebseek(dst, dst_off);
+	if (ebput(dst, s, len) == -1) {
+		ebseek(dst, dcursor);
+		return -1;
+	}
+
+	ebseek(src, src_off + len);
+	if (ebdel(src, len) == -1) {
+		/* Take the text back out so that it is not copied */
+		ebseek(dst, dst_off + len);
+		ebdel(dst, len);
+		ebseek(dst, dcursor);
+		ebseek(src, scursor);
+		return -1;
+	}
+	ebseek(src, _shift(scursor, src_off, len));
+	ebseek(dst, dcursor > dst_off ? dcursor + len : dcursor);
+
+	return 0;
+}
+
+/*
+ * Returns the number of blocks in (len) bytes at (off) of (b) whose
+ * text has to be copied.
+ */
+static size_t
+_copies(TxtBuffer *b, size_t off, size_t len)
+{
+	TxtBlock *np;
+	size_t n, so;
+
+	ebseek(b, off);
+	n = 0;
+	so = b->root_offset;
+	for (np = b->root; np != NULL && so < off + len; np = np->next) {
+		if (np == &b->small || (np->flags & EBF_MAPPED))
+			n++;
+		so += np->len;
+	}
+
+	return n;
+}
+
+/*
+ * Moves (np), which is linked in a list of its own, from (src) to
+ * (dst). Returns the block that replaces it in the list, which is a
+ * copy if it is the inline block of (src) or its text does not belong
+ * to the block.
+ */
+static TxtBlock *
+_take(TxtBuffer *dst, TxtBuffer *src, TxtBlock *np)
+{
+	TxtBlock *nb;
+	char *text;
+
+	if (np == &src->small || (np->flags & EBF_MAPPED)) {
+		nb = eb_allocblock(dst);
+		text = EBTEXT(src, np);
+		memcpy(EBTEXT(dst, nb), text, np->len);
+		nb->len = np->len;
+		if ((nb->prev = np->prev) != NULL)
+			nb->prev->next = nb;
+		if ((nb->next = np->next) != NULL)
+			nb->next->prev = nb;
+		eb_freeblock(src, np);
+		return nb;
+	}
+
+	eb_adopt(dst, src, np);
+	src->blocks--;
+	src->shape++;
+	src->alloc -= sizeof(TxtBlock);
+	dst->blocks++;
+	dst->shape++;
+	dst->alloc += sizeof(TxtBlock);
+
+	return np;
+}
+
+/*
+ * Makes (np) at (so) the current block of (b) and moves the cursor to
+ * (cursor) from there.
+ */
+static void
+_seek(TxtBuffer *b, TxtBlock *np, size_t so, size_t cursor)
+{
+	b->root = np;
+	b->root_offset = np != NULL ? so : 0;
+	if (b->root == NULL)
+		b->last = NULL;
+	b->offset = b->root_offset;
+	ebseek(b, cursor);
+}
+
+/*
+ * Returns where (cursor) ends up when (len) bytes at (off) go away.
+ */
+static size_t
+_shift(size_t cursor, size_t off, size_t len)
+{
+	if (cursor > off + len)
+		return cursor - len;
+	else if (cursor > off)
+		return off;
+	return cursor;
+}
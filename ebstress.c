@@ -0,0 +1,154 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Stress benchmark for offsets beyond 32 bits: builds a buffer larger
+ * than 4 GB, puts markers past the 2 GB and 4 GB boundaries and times
+ * navigating to them. Blocks are kept compressed so that it fits in a
+ * modest amount of memory.
+ *
+ * Usage: ebstress [megabytes [resident blocks]]
+ */
+
+#include "editbuffer.h"
+#include <time.h>
+
+#define LINE	"the quick brown fox jumps over the lazy dog, again and again.\n"
+#define CHUNK	(1024 * 1024)
+
+static double	_elapsed(struct timespec *);
+static void	_mark(TxtBuffer *, size_t);
+static void	_check(TxtBuffer *, size_t, size_t);
+
+int
+main(int argc, char *argv[])
+{
+	static TxtBuffer buffer;
+	struct timespec t;
+	size_t size, resident, linelen, i, n, marks[3];
+	char *chunk;
+
+	size = argc > 1 ? strtoull(argv[1], NULL, 10) : 4608;
+	resident = argc > 2 ? strtoull(argv[2], NULL, 10) : 256;
+	size *= 1024 * 1024;
+
+	linelen = strlen(LINE);
+	if ((chunk = malloc(CHUNK)) == NULL)
+		err(1, "making space for chunk");
+	for (i = 0; i < CHUNK; i++)
+		chunk[i] = LINE[i % linelen];
+	n = CHUNK - CHUNK % linelen;
+
+	ebcompress(&buffer, resident);
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	while (buffer.len < size) {
+		ebseek(&buffer, buffer.len);
+		if (ebput(&buffer, chunk, n) == -1)
+			err(1, "ebput");
+	}
+	printf("put %zu bytes: %.2fs, %zu blocks\n", buffer.len,
+	    _elapsed(&t), buffer.blocks);
+
+	/* Markers go to the middle of a line past each boundary */
+	marks[0] = (1UL << 31) + 3 * linelen + 7;
+	marks[1] = (1UL << 32) + 5 * linelen + 11;
+	marks[2] = buffer.len - linelen / 2;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (i = 0; i < 3; i++)
+		_mark(&buffer, marks[i]);
+	printf("mark: %.2fs\n", _elapsed(&t));
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (i = 0; i < 3; i++)
+		_check(&buffer, marks[i], linelen);
+	printf("check: %.2fs\n", _elapsed(&t));
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	if ((size_t) ebfind(&buffer, '#', 0, 1) != marks[0])
+		errx(1, "ebfind did not find the first marker");
+	for (i = 1; i < 3; i++)
+		if ((size_t) ebfind(&buffer, '#', marks[i - 1] + 1, 1) !=
+		    marks[i])
+			errx(1, "ebfind did not find marker %zu", i);
+	if ((size_t) ebfind(&buffer, '#', marks[2] + 1, 1) != buffer.len)
+		errx(1, "ebfind did not stop at the end");
+	printf("find: %.2fs\n", _elapsed(&t));
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (i = 3; i-- > 0; ) {
+		ebseek(&buffer, marks[i] + 1);
+		ebdel(&buffer, 1);
+	}
+	if (ebfind(&buffer, '#', 0, 1) != buffer.len)
+		errx(1, "markers left after deleting them");
+	printf("delete and find: %.2fs\n", _elapsed(&t));
+
+	printf("usage: %zu bytes\n", ebusage(&buffer));
+
+	ebclose(&buffer);
+	free(chunk);
+	return 0;
+}
+
+static double
+_elapsed(struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+/*
+ * Inserts a marker at (off).
+ */
+static void
+_mark(TxtBuffer *b, size_t off)
+{
+	ebseek(b, off);
+	if (ebput(b, "#", 1) == -1)
+		err(1, "ebput");
+	if (ebtell(b) != off)
+		errx(1, "cursor moved to %zu from %zu", ebtell(b), off);
+}
+
+/*
+ * Verifies reading and line navigation around the marker at (off).
+ */
+static void
+_check(TxtBuffer *b, size_t off, size_t linelen)
+{
+	size_t bol, eol;
+
+	if (ebseek(b, off) != off || ebget(b) != '#')
+		errx(1, "no marker at %zu", off);
+	if (ebtell(b) != off + 1)
+		errx(1, "ebget left cursor at %zu", ebtell(b));
+
+	bol = ebfindbol(b, off);
+	eol = ebfindeol(b, off);
+	if (bol > off || off - bol >= linelen || eol < off ||
+	    eol - bol != linelen)
+		errx(1, "line at %zu is %zu-%zu", off, bol, eol);
+	if (ebfindcol(b, off) != off - bol)
+		errx(1, "column at %zu is %zu", off, ebfindcol(b, off));
+	if (ebfindnext(b, off) != eol + 1 && eol != b->len)
+		errx(1, "next line from %zu", off);
+	if (ebscroll(b, eol + 1, -1) != bol)
+		errx(1, "scroll up from %zu", eol + 1);
+}
@@ -0,0 +1,152 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Per-buffer swap file for the text of least recently used blocks, see
+ * ebcache.c. The file is divided into slots of TXTBLOCK_ALLOC bytes and
+ * it is unlinked right after creation so that it goes away with the
+ * process. Block headers always stay in memory.
+ */
+
+#include "editbuffer.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+struct txt_swap {
+	int fd;
+	size_t budget;		/* Bytes of resident text */
+	size_t nslots;		/* Slots in the file */
+	size_t *free;		/* Stack of free slots */
+	size_t nfree;
+	size_t maxfree;
+};
+
+/*
+ * Keeps at most (budget) bytes of text of (buffer) in memory and
+ * writes the rest to a temporary file in (dir), or in TMPDIR if NULL.
+ * Zero budget brings everything back to memory and removes the file.
+ *
+ * Returns 0 on success or -1 if the file could not be created.
+ */
+int
+ebswap(TxtBuffer *buffer, size_t budget, const char *dir)
+{
+	TxtSwap *swap;
+	char path[PATH_MAX];
+	int fd;
+
+	if (budget == 0) {
+		if ((swap = buffer->swap) == NULL)
+			return 0;
+		swap->budget = 0;
+		eb_recache(buffer);
+		buffer->swap = NULL;
+		close(swap->fd);
+		free(swap->free);
+		free(swap);
+		return 0;
+	}
+
+	if (buffer->swap == NULL) {
+		if (dir == NULL && (dir = getenv("TMPDIR")) == NULL)
+			dir = "/tmp";
+		if (snprintf(path, sizeof(path), "%s/ebswap.XXXXXXXXXX",
+		    dir) >= sizeof(path))
+			return -1;
+		if ((fd = mkstemp(path)) == -1)
+			return -1;
+		unlink(path);
+		if ((swap = calloc(1, sizeof(TxtSwap))) == NULL)
+			err(1, "making space for swap");
+		swap->fd = fd;
+		buffer->swap = swap;
+	}
+	buffer->swap->budget = budget;
+	eb_recache(buffer);
+
+	return 0;
+}
+
+/*
+ * Returns the number of resident blocks allowed by the swap budget or
+ * zero if swapping is disabled.
+ */
+size_t
+eb_swaplimit(TxtBuffer *buffer)
+{
+	size_t n;
+
+	if (buffer->swap == NULL || buffer->swap->budget == 0)
+		return 0;
+	if ((n = buffer->swap->budget / TXTBLOCK_ALLOC) == 0)
+		n = 1;
+	return n;
+}
+
+/*
+ * Writes (len) bytes of evicted text (s) of (block) to a free slot.
+ */
+void
+eb_swapout(TxtBuffer *buffer, TxtBlock *block, char *s, size_t len)
+{
+	TxtSwap *swap = buffer->swap;
+
+	if (swap->nfree > 0)
+		block->slot = swap->free[--swap->nfree];
+	else
+		block->slot = swap->nslots++;
+
+	if (pwrite(swap->fd, s, len,
+	    (off_t) block->slot * TXTBLOCK_ALLOC) != len)
+		err(1, "writing swap");
+
+	block->flags |= EBF_SWAPPED;
+}
+
+/*
+ * Reads the evicted text of (block) to (s) and frees its slot.
+ */
+void
+eb_swapin(TxtBuffer *buffer, TxtBlock *block, char *s)
+{
+	if (pread(buffer->swap->fd, s, block->zlen,
+	    (off_t) block->slot * TXTBLOCK_ALLOC) != block->zlen)
+		err(1, "reading swap");
+
+	eb_swapfree(buffer, block);
+}
+
+/*
+ * Frees the slot of (block).
+ */
+void
+eb_swapfree(TxtBuffer *buffer, TxtBlock *block)
+{
+	TxtSwap *swap = buffer->swap;
+	size_t *p;
+
+	if (swap->nfree == swap->maxfree) {
+		swap->maxfree = swap->maxfree ? swap->maxfree * 2 : 64;
+		if ((p = reallocarray(swap->free, swap->maxfree,
+		    sizeof(size_t))) == NULL)
+			err(1, "making space for swap");
+		swap->free = p;
+	}
+	swap->free[swap->nfree++] = block->slot;
+	block->flags &= ~EBF_SWAPPED;
+}
@@ -0,0 +1,302 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Syntax state checkpoints. A highlighter stores its opaque lexer state
+ * at the beginning of every (interval)th line as it goes, so that after
+ * an edit it can resume from a nearby line instead of the top of the
+ * buffer:
+ *
+ *	while ((d = ebsyntaxdamage(b)) != -1) {
+ *		pos = ebsyntaxresume(b, d, &state);
+ *		do {
+ *			pos = lex one line at pos with state;
+ *		} while (!ebsyntaxmark(b, pos, &state));
+ *	}
+ *
+ * An edit leaves a damage point where it happened and the states of
+ * the checkpoints after it are not trusted. Once the highlighter has
+ * lexed past the damage and arrives at a checkpoint with the same state
+ * as before, the state has converged and the checkpoints up to the next
+ * damage point are good again. The highlighter can stop there, so the
+ * cost of an edit is proportional to the lines whose state it changed.
+ */
+
+#include "editbuffer.h"
+
+struct txt_syntax {
+	size_t statelen;	/* Bytes of caller state */
+	size_t interval;	/* Lines between checkpoints */
+	size_t lines;		/* Lines marked since the last checkpoint */
+	size_t *off;		/* Checkpoints at line beginnings, sorted */
+	char *state;		/* State of each checkpoint */
+	size_t n;
+	size_t max;
+	size_t *damage;		/* States after these may be wrong, sorted */
+	size_t ndamage;
+	size_t maxdamage;
+};
+
+static size_t	_search(size_t *, size_t, size_t);
+static void	_damage(TxtSyntax *, size_t, size_t);
+static void	_store(TxtSyntax *, size_t, size_t, const void *);
+
+/*
+ * Enables syntax state checkpoints of (statelen) bytes at every
+ * (interval)th line of (b), discarding any earlier checkpoints. Zero
+ * (statelen) disables them.
+ */
+void
+ebsyntax(TxtBuffer *b, size_t statelen, size_t interval)
+{
+	TxtSyntax *s;
+
+	eb_syntaxfree(b);
+	if (statelen == 0)
+		return;
+
+	if ((s = calloc(1, sizeof(TxtSyntax))) == NULL)
+		err(1, "making space for syntax");
+	s->statelen = statelen;
+	s->interval = interval > 0 ? interval : 1;
+	b->syntax = s;
+
+	/* Nothing has been lexed yet */
+	_damage(s, 0, 0);
+}
+
+/*
+ * Returns the first offset of (b) after which the syntax states are
+ * not known, or -1 if they all are.
+ */
+ssize_t
+ebsyntaxdamage(TxtBuffer *b)
+{
+	TxtSyntax *s;
+
+	if ((s = b->syntax) == NULL || s->ndamage == 0)
+		return -1;
+
+	return s->damage[0];
+}
+
+/*
+ * Stores the state of the last good checkpoint at or before (pos) of
+ * (b) to (state) and returns its offset, which is the beginning of a
+ * line. Without such a checkpoint the state is all zero at offset 0.
+ */
+size_t
+ebsyntaxresume(TxtBuffer *b, size_t pos, void *state)
+{
+	TxtSyntax *s;
+	size_t i;
+
+	if ((s = b->syntax) == NULL)
+		return 0;
+	if (s->ndamage > 0 && pos > s->damage[0])
+		pos = s->damage[0];
+
+	s->lines = 0;
+	if ((i = _search(s->off, s->n, pos + 1)) == 0) {
+		memset(state, 0, s->statelen);
+		return 0;
+	}
+	i--;
+	memcpy(state, &s->state[i * s->statelen], s->statelen);
+	return s->off[i];
+}
+
+/*
+ * Tells that lexing from ebsyntaxresume() arrived with (state) at
+ * (off) of (b), which is the beginning of a line or the end of the
+ * buffer. Call this for every line in order.
+ *
+ * Returns non-zero if the states from (off) up to ebsyntaxdamage()
+ * are known, so that lexing can stop.
+ */
+int
+ebsyntaxmark(TxtBuffer *b, size_t off, const void *state)
+{
+	TxtSyntax *s;
+	size_t i, k;
+	char *cp;
+
+	if ((s = b->syntax) == NULL)
+		return 1;
+	if (off >= b->len) {
+		s->ndamage = 0;
+		return 1;
+	}
+
+	/* Damage before (off) has been lexed over */
+	k = _search(s->damage, s->ndamage, off);
+
+	i = _search(s->off, s->n, off);
+	if (i < s->n && s->off[i] == off) {
+		cp = &s->state[i * s->statelen];
+		if (memcmp(cp, state, s->statelen) == 0) {
+			s->ndamage -= k;
+			memmove(s->damage, &s->damage[k],
+			    s->ndamage * sizeof(size_t));
+			s->lines = 0;
+			return 1;
+		}
+		memcpy(cp, state, s->statelen);
+		s->lines = 0;
+	} else if (++s->lines >= s->interval) {
+		_store(s, i, off, state);
+		s->lines = 0;
+	}
+
+	/* Lexing continues to be the only thing trusted after (off) */
+	if (k > 0) {
+		s->damage[0] = off;
+		s->ndamage -= k - 1;
+		memmove(&s->damage[1], &s->damage[k],
+		    (s->ndamage - 1) * sizeof(size_t));
+		if (s->ndamage > 1 && s->damage[1] == off) {
+			s->ndamage--;
+			memmove(&s->damage[1], &s->damage[2],
+			    (s->ndamage - 1) * sizeof(size_t));
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Moves the checkpoints after (newlen) bytes at (off) replaced
+ * (oldlen) bytes and leaves a damage point at (off).
+ */
+void
+eb_syntaxchanged(TxtBuffer *b, size_t off, size_t oldlen, size_t newlen)
+{
+	TxtSyntax *s;
+	size_t i, j, end;
+
+	s = b->syntax;
+	end = off + oldlen;
+
+	/*
+	 * A checkpoint right after the replaced text is not necessarily
+	 * at the beginning of a line anymore.
+	 */
+	i = _search(s->off, s->n, off + 1);
+	j = _search(s->off, s->n, end + 1);
+	if (j > i) {
+		memmove(&s->off[i], &s->off[j], (s->n - j) * sizeof(size_t));
+		memmove(&s->state[i * s->statelen],
+		    &s->state[j * s->statelen], (s->n - j) * s->statelen);
+		s->n -= j - i;
+	}
+	for (; i < s->n; i++)
+		s->off[i] = s->off[i] - oldlen + newlen;
+
+	i = _search(s->damage, s->ndamage, off + 1);
+	j = _search(s->damage, s->ndamage, end + 1);
+	memmove(&s->damage[i], &s->damage[j],
+	    (s->ndamage - j) * sizeof(size_t));
+	s->ndamage -= j - i;
+	for (j = i; j < s->ndamage; j++)
+		s->damage[j] = s->damage[j] - oldlen + newlen;
+
+	if (i == 0 || s->damage[i - 1] != off)
+		_damage(s, i, off);
+}
+
+/*
+ * Frees the checkpoints of (b).
+ */
+void
+eb_syntaxfree(TxtBuffer *b)
+{
+	if (b->syntax == NULL)
+		return;
+	free(b->syntax->off);
+	free(b->syntax->state);
+	free(b->syntax->damage);
+	free(b->syntax);
+	b->syntax = NULL;
+}
+
+/*
+ * Returns the index of the first of (n) sorted offsets in (a) that is
+ * at least (off).
+ */
+static size_t
+_search(size_t *a, size_t n, size_t off)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (a[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Inserts damage point (off) at index (i).
+ */
+static void
+_damage(TxtSyntax *s, size_t i, size_t off)
+{
+	size_t max;
+
+	if (s->ndamage == s->maxdamage) {
+		max = s->maxdamage > 0 ? s->maxdamage * 2 : 8;
+		if ((s->damage = reallocarray(s->damage, max,
+		    sizeof(size_t))) == NULL)
+			err(1, "making space for damage");
+		s->maxdamage = max;
+	}
+	memmove(&s->damage[i + 1], &s->damage[i],
+	    (s->ndamage - i) * sizeof(size_t));
+	s->damage[i] = off;
+	s->ndamage++;
+}
+
+/*
+ * Inserts a checkpoint with (state) at (off) to index (i).
+ */
+static void
+_store(TxtSyntax *s, size_t i, size_t off, const void *state)
+{
+	size_t max;
+
+	if (s->n == s->max) {
+		max = s->max > 0 ? s->max * 2 : 64;
+		if ((s->off = reallocarray(s->off, max,
+		    sizeof(size_t))) == NULL ||
+		    (s->state = reallocarray(s->state, max,
+		    s->statelen)) == NULL)
+			err(1, "making space for checkpoints");
+		s->max = max;
+	}
+	memmove(&s->off[i + 1], &s->off[i], (s->n - i) * sizeof(size_t));
+	memmove(&s->state[(i + 1) * s->statelen], &s->state[i * s->statelen],
+	    (s->n - i) * s->statelen);
+	s->off[i] = off;
+	memcpy(&s->state[i * s->statelen], state, s->statelen);
+	s->n++;
+}
@@ -0,0 +1,647 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Word index for completion. The buffer is divided into pieces of
+ * about a block of text that end between words, and each piece
+ * remembers the distinct words that occur in it. The words of all the
+ * pieces are kept in a crit-bit tree, which keeps them in order so
+ * that the words with a given prefix are found without looking at the
+ * others.
+ *
+ * An edit only forgets the words of the pieces it touched, and they
+ * are scanned again the next time completions are asked for. Keeping
+ * the index up to date costs in proportion to the text edited, not to
+ * the size of the buffer.
+ */
+
+#include "editbuffer.h"
+#include <stdint.h>
+
+#define EB_WORDPIECE	TXTBLOCK_MAXLEN	/* Bytes of text per piece */
+#define EB_WORDMAX	128	/* Longer words are not indexed */
+#define EB_WORDCHARS	"0-9A-Z_a-z\x80-\xff"
+
+/*
+ * Internal nodes of the tree are told apart from words by setting the
+ * lowest bit of the pointers to them.
+ */
+#define ISNODE(p)	((uintptr_t) (p) & 1)
+#define NODE(p)		((struct wnode *) ((uintptr_t) (p) - 1))
+#define TAG(q)		((void *) ((uintptr_t) (q) + 1))
+
+/*
+ * Child to take at a node with (bits) for byte (c) of a word.
+ */
+#define DIR(bits, c)	((1 + ((bits) | (c))) >> 8)
+
+struct wleaf {
+	size_t refs;		/* Pieces the word occurs in */
+	size_t gen;		/* Piece that found the word last */
+	size_t len;
+	char s[];		/* NUL terminated */
+};
+
+struct wnode {
+	void *child[2];
+	size_t byte;		/* First byte where the children differ */
+	unsigned int bits;	/* All bits but the first that differs */
+};
+
+struct wpiece {
+	size_t off;
+	size_t len;
+	struct wleaf **words;	/* Distinct words that start here */
+	size_t n;
+	size_t max;
+	int dirty;		/* Edited since scanned */
+};
+
+struct txt_words {
+	unsigned char class[256];	/* Non-zero for word characters */
+	int active;		/* Index is kept, see ebcomplete */
+	void *root;		/* Tree of the words */
+	size_t gen;		/* Bumped for every piece scanned */
+	struct wpiece *piece;	/* Sorted, covering the whole buffer */
+	size_t n;
+	size_t max;
+	size_t ndirty;		/* Dirty pieces */
+	size_t first;		/* None of them before this one */
+};
+
+static TxtWords		*_words(TxtBuffer *);
+static void		 _classes(unsigned char *, const char *);
+static void		 _reset(TxtWords *, size_t);
+static size_t		 _scan(TxtBuffer *, size_t);
+static int		 _isword(TxtBuffer *, size_t);
+static size_t		 _piece(TxtWords *, size_t);
+static void		 _open(TxtWords *, size_t, size_t);
+static void		 _close(TxtWords *, size_t, size_t);
+static void		 _add(TxtWords *, struct wpiece *, const char *, size_t);
+static void		 _release(TxtWords *, struct wpiece *);
+static struct wleaf	*_insert(TxtWords *, const char *, size_t);
+static struct wleaf	*_leaf(const char *, size_t);
+static void		 _remove(TxtWords *, struct wleaf *);
+static size_t		 _walk(void *, TxtWord *, size_t, size_t);
+
+/*
+ * Stores the word at or right before offset (i) of (b) to (word) of
+ * (size) bytes, truncated if needed and NUL terminated, and moves the
+ * cursor to the beginning of the word. Words consist of the characters
+ * set by ebwordchars().
+ *
+ * Returns the length of the whole word, or 0 if there is none.
+ */
+size_t
+ebwordat_r(TxtBuffer *b, size_t i, char *word, size_t size)
+{
+	TxtWords *w;
+	size_t begin, end, off, k, n;
+	char *text;
+
+	w = _words(b);
+	if (i > b->len)
+		i = b->len;
+
+	for (begin = i; (k = ebrspan(b, begin, &text)) > 0; ) {
+		for (n = k; n > 0 && w->class[(unsigned char) text[n - 1]]; n--)
+			;
+		begin -= k - n;
+		if (n > 0)
+			break;
+	}
+	for (end = i; (k = ebspan(b, end, &text)) > 0; ) {
+		for (n = 0; n < k && w->class[(unsigned char) text[n]]; n++)
+			;
+		end += n;
+		if (n < k)
+			break;
+	}
+
+	if (size > 0) {
+		for (n = 0, off = begin; off < end && n < size - 1; off += k) {
+			k = ebspan(b, off, &text);
+			if (k > end - off)
+				k = end - off;
+			if (k > size - 1 - n)
+				k = size - 1 - n;
+			memcpy(&word[n], text, k);
+			n += k;
+		}
+		word[n] = '\0';
+	}
+	ebseek(b, begin);
+
+	return end - begin;
+}
+
+/*
+ * Like ebwordat_r() but stores the word to a static buffer.
+ */
+char *
+ebwordat(TxtBuffer *b, size_t i)
+{
+	static char word[256 + 1];
+
+	ebwordat_r(b, i, word, sizeof(word));
+	return word;
+}
+
+/*
+ * Sets the bytes in (set) as the word characters of (b). A range of
+ * bytes is given as, e.g. "a-z", and a '-' at either end stands for
+ * itself. NULL sets the default of letters, digits, underscore and the
+ * bytes of UTF-8 sequences.
+ */
+void
+ebwordchars(TxtBuffer *b, const char *set)
+{
+	TxtWords *w;
+
+	w = _words(b);
+	_classes(w->class, set != NULL ? set : EB_WORDCHARS);
+	if (w->active)
+		_reset(w, b->len);
+}
+
+/*
+ * Stores up to (n) words of (b) that begin with the (len) bytes at
+ * (prefix) to (out), in byte order. They are valid until (b) is edited
+ * or ebwordchars() is called. The first call builds the index of words
+ * and later calls only scan the text edited in between. The cursor
+ * stays where it was.
+ *
+ * Returns the number of words stored.
+ */
+size_t
+ebcomplete(TxtBuffer *b, const char *prefix, size_t len, TxtWord *out,
+    size_t n)
+{
+	TxtWords *w;
+	struct wnode *q;
+	struct wleaf *leaf;
+	void *p, *top;
+	size_t cursor, i;
+	unsigned int c;
+
+	w = _words(b);
+	if (!w->active) {
+		w->active = 1;
+		_reset(w, b->len);
+	}
+
+	cursor = b->offset;
+	for (i = w->first; w->ndirty > 0; )
+		if (w->piece[i].dirty)
+			i += _scan(b, i);
+		else
+			i++;
+	ebseek(b, cursor);
+
+	if ((p = w->root) == NULL || n == 0)
+		return 0;
+
+	/* The smallest subtree that has all words with the prefix */
+	top = p;
+	while (ISNODE(p)) {
+		q = NODE(p);
+		c = q->byte < len ? (unsigned char) prefix[q->byte] : 0;
+		p = q->child[DIR(q->bits, c)];
+		if (q->byte < len)
+			top = p;
+	}
+	leaf = p;
+	if (leaf->len < len || memcmp(leaf->s, prefix, len) != 0)
+		return 0;
+
+	return _walk(top, out, 0, n);
+}
+
+/*
+ * Forgets the words of the pieces where (newlen) bytes at (off)
+ * replaced (oldlen) bytes, which are scanned again by ebcomplete().
+ */
+void
+eb_wordchanged(TxtBuffer *b, size_t off, size_t oldlen, size_t newlen)
+{
+	TxtWords *w;
+	struct wpiece *p;
+	size_t i, j, end;
+
+	if (!(w = b->words)->active)
+		return;
+	if (w->n == 0) {
+		_reset(w, newlen);
+		return;
+	}
+
+	/* Merge the pieces that lost text */
+	i = _piece(w, off);
+	p = &w->piece[i];
+	_release(w, p);
+	end = off + oldlen;
+	for (j = i + 1; j < w->n && w->piece[j].off < end; j++) {
+		_release(w, &w->piece[j]);
+		p->len += w->piece[j].len;
+		if (w->piece[j].dirty)
+			w->ndirty--;
+	}
+	_close(w, i + 1, j - (i + 1));
+
+	p->len = p->len - oldlen + newlen;
+	if (!p->dirty) {
+		p->dirty = 1;
+		if (w->ndirty++ == 0 || i < w->first)
+			w->first = i;
+	}
+	for (j = i + 1; j < w->n; j++)
+		w->piece[j].off = w->piece[j].off - oldlen + newlen;
+}
+
+/*
+ * Frees the word index of (b).
+ */
+void
+eb_wordfree(TxtBuffer *b)
+{
+	if (b->words == NULL)
+		return;
+	_reset(b->words, 0);
+	free(b->words->piece);
+	free(b->words);
+	b->words = NULL;
+}
+
+static TxtWords *
+_words(TxtBuffer *b)
+{
+	if (b->words != NULL)
+		return b->words;
+
+	if ((b->words = calloc(1, sizeof(TxtWords))) == NULL)
+		err(1, "making space for words");
+	_classes(b->words->class, EB_WORDCHARS);
+	return b->words;
+}
+
+static void
+_classes(unsigned char *class, const char *set)
+{
+	const unsigned char *s;
+	int c;
+
+	memset(class, 0, 256);
+	for (s = (const unsigned char *) set; *s != '\0'; s++) {
+		if (s[1] == '-' && s[2] != '\0') {
+			for (c = s[0]; c <= s[2]; c++)
+				class[c] = 1;
+			s += 2;
+		} else
+			class[*s] = 1;
+	}
+}
+
+/*
+ * Forgets all words and leaves the (len) bytes of text to be scanned.
+ */
+static void
+_reset(TxtWords *w, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < w->n; i++)
+		_release(w, &w->piece[i]);
+	w->n = w->ndirty = w->first = 0;
+
+	if (len > 0) {
+		_open(w, 0, 1);
+		w->piece[0].len = len;
+		w->piece[0].dirty = 1;
+		w->ndirty = 1;
+	}
+}
+
+/*
+ * Scans the words of dirty piece (i) of (b) to pieces of their own.
+ *
+ * Returns the number of pieces that replace it.
+ */
+static size_t
+_scan(TxtBuffer *b, size_t i)
+{
+	TxtWords *w;
+	struct wpiece *p;
+	char word[EB_WORDMAX], *text;
+	size_t start, end, off, k, j, n, wlen;
+	unsigned char c;
+
+	w = b->words;
+	start = w->piece[i].off;
+	end = start + w->piece[i].len;
+
+	/* A word that now continues to the next piece takes it along */
+	w->ndirty--;
+	while (i + 1 < w->n && end > start && _isword(b, end - 1)) {
+		if (w->piece[i + 1].dirty)
+			w->ndirty--;
+		_release(w, &w->piece[i + 1]);
+		end += w->piece[i + 1].len;
+		_close(w, i + 1, 1);
+	}
+	_close(w, i, 1);
+	if (start == end)
+		return 0;
+
+	n = 0;
+	_open(w, i, 1);
+	p = &w->piece[i];
+	p->off = start;
+	w->gen++;
+
+	wlen = 0;
+	for (off = start; off < end; off += k) {
+		if ((k = ebspan(b, off, &text)) > end - off)
+			k = end - off;
+		for (j = 0; j < k; j++) {
+			c = text[j];
+			if (w->class[c]) {
+				if (wlen < EB_WORDMAX)
+					word[wlen] = c;
+				wlen++;
+				continue;
+			}
+			if (wlen > 0 && wlen <= EB_WORDMAX)
+				_add(w, p, word, wlen);
+			wlen = 0;
+
+			if (off + j + 1 - p->off < EB_WORDPIECE ||
+			    off + j + 1 == end)
+				continue;
+			p->len = off + j + 1 - p->off;
+			_open(w, i + ++n, 1);
+			p = &w->piece[i + n];
+			p->off = off + j + 1;
+			w->gen++;
+		}
+	}
+	if (wlen > 0 && wlen <= EB_WORDMAX)
+		_add(w, p, word, wlen);
+	p->len = end - p->off;
+
+	return n + 1;
+}
+
+static int
+_isword(TxtBuffer *b, size_t off)
+{
+	int c;
+
+	ebseek(b, off);
+	return (c = ebget(b)) != EOF && b->words->class[c];
+}
+
+/*
+ * Returns the index of the last piece of (w) that starts at or before
+ * (off).
+ */
+static size_t
+_piece(TxtWords *w, size_t off)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = w->n;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (w->piece[mid].off <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Inserts (n) empty pieces at index (i).
+ */
+static void
+_open(TxtWords *w, size_t i, size_t n)
+{
+	size_t max;
+
+	if (w->n + n > w->max) {
+		for (max = w->max > 0 ? w->max : 64; max < w->n + n; max *= 2)
+			;
+		if ((w->piece = reallocarray(w->piece, max,
+		    sizeof(struct wpiece))) == NULL)
+			err(1, "making space for words");
+		w->max = max;
+	}
+	memmove(&w->piece[i + n], &w->piece[i],
+	    (w->n - i) * sizeof(struct wpiece));
+	memset(&w->piece[i], 0, n * sizeof(struct wpiece));
+	w->n += n;
+}
+
+/*
+ * Removes (n) pieces at index (i), whose words have been released.
+ */
+static void
+_close(TxtWords *w, size_t i, size_t n)
+{
+	if (n == 0)
+		return;
+	memmove(&w->piece[i], &w->piece[i + n],
+	    (w->n - i - n) * sizeof(struct wpiece));
+	w->n -= n;
+}
+
+/*
+ * Adds the (len) bytes at (s) to the words of piece (p).
+ */
+static void
+_add(TxtWords *w, struct wpiece *p, const char *s, size_t len)
+{
+	struct wleaf *leaf;
+	size_t max;
+
+	leaf = _insert(w, s, len);
+	if (leaf->gen == w->gen)
+		return;
+	leaf->gen = w->gen;
+	leaf->refs++;
+
+	if (p->n == p->max) {
+		max = p->max > 0 ? p->max * 2 : 16;
+		if ((p->words = reallocarray(p->words, max,
+		    sizeof(struct wleaf *))) == NULL)
+			err(1, "making space for words");
+		p->max = max;
+	}
+	p->words[p->n++] = leaf;
+}
+
+/*
+ * Forgets the words of piece (p).
+ */
+static void
+_release(TxtWords *w, struct wpiece *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->n; i++)
+		if (--p->words[i]->refs == 0)
+			_remove(w, p->words[i]);
+	free(p->words);
+	p->words = NULL;
+	p->n = p->max = 0;
+}
+
+/*
+ * Returns the word of the (len) bytes at (s), which is added to the
+ * tree unless it is there already.
+ */
+static struct wleaf *
+_insert(TxtWords *w, const char *s, size_t len)
+{
+	const unsigned char *u = (const unsigned char *) s;
+	struct wleaf *leaf, *nl;
+	struct wnode *q, *nq;
+	void **wherep, *p;
+	size_t byte;
+	unsigned int bits, c, dir;
+
+	if ((p = w->root) == NULL)
+		return w->root = _leaf(s, len);
+
+	/* The word that has the most in common with the new one */
+	while (ISNODE(p)) {
+		q = NODE(p);
+		c = q->byte < len ? u[q->byte] : 0;
+		p = q->child[DIR(q->bits, c)];
+	}
+	leaf = p;
+
+	for (byte = 0; byte < len; byte++)
+		if ((bits = (unsigned char) leaf->s[byte] ^ u[byte]) != 0)
+			break;
+	if (byte == len && (bits = (unsigned char) leaf->s[byte]) == 0)
+		return leaf;
+
+	/* Keep the highest bit that differs, inverted */
+	bits |= bits >> 1;
+	bits |= bits >> 2;
+	bits |= bits >> 4;
+	bits = (bits & ~(bits >> 1)) ^ 255;
+	dir = DIR(bits, (unsigned char) leaf->s[byte]);
+
+	if ((nq = malloc(sizeof(*nq))) == NULL)
+		err(1, "making space for words");
+	nl = _leaf(s, len);
+	nq->byte = byte;
+	nq->bits = bits;
+	nq->child[1 - dir] = nl;
+
+	wherep = &w->root;
+	while (ISNODE(p = *wherep)) {
+		q = NODE(p);
+		if (q->byte > byte || (q->byte == byte && q->bits > bits))
+			break;
+		c = q->byte < len ? u[q->byte] : 0;
+		wherep = &q->child[DIR(q->bits, c)];
+	}
+	nq->child[dir] = *wherep;
+	*wherep = TAG(nq);
+
+	return nl;
+}
+
+static struct wleaf *
+_leaf(const char *s, size_t len)
+{
+	struct wleaf *leaf;
+
+	if ((leaf = malloc(sizeof(*leaf) + len + 1)) == NULL)
+		err(1, "making space for words");
+	leaf->refs = leaf->gen = 0;
+	leaf->len = len;
+	memcpy(leaf->s, s, len);
+	leaf->s[len] = '\0';
+
+	return leaf;
+}
+
+/*
+ * Removes (leaf) from the tree and frees it.
+ */
+static void
+_remove(TxtWords *w, struct wleaf *leaf)
+{
+	const unsigned char *u = (const unsigned char *) leaf->s;
+	struct wnode *q;
+	void **wherep, **whereq, *p;
+	unsigned int c, dir;
+
+	q = NULL;
+	whereq = NULL;
+	wherep = &w->root;
+	dir = 0;
+	while (ISNODE(p = *wherep)) {
+		whereq = wherep;
+		q = NODE(p);
+		c = q->byte < leaf->len ? u[q->byte] : 0;
+		dir = DIR(q->bits, c);
+		wherep = &q->child[dir];
+	}
+	assert(p == leaf);
+	free(leaf);
+
+	if (whereq == NULL) {
+		w->root = NULL;
+		return;
+	}
+	*whereq = q->child[1 - dir];
+	free(q);
+}
+
+/*
+ * Stores the words under (p) to (out) from index (i) up to (n) in
+ * order.
+ *
+ * Returns the index after the last one stored.
+ */
+static size_t
+_walk(void *p, TxtWord *out, size_t i, size_t n)
+{
+	struct wnode *q;
+	struct wleaf *leaf;
+
+	if (ISNODE(p)) {
+		q = NODE(p);
+		i = _walk(q->child[0], out, i, n);
+		if (i < n)
+			i = _walk(q->child[1], out, i, n);
+		return i;
+	}
+
+	leaf = p;
+	out[i].s = leaf->s;
+	out[i].len = leaf->len;
+	out[i].count = leaf->refs;
+	return i + 1;
+}
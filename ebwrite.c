@@ -0,0 +1,193 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writing text to a file. This is the save counterpart of ebnormalize:
+ * the text is kept with LF line endings and converted back to the line
+ * endings of the file while writing.
+ */
+
+#include "editbuffer.h"
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+static int	_writecrlf(FILE *, const char *, size_t, int *);
+static void	_umask(void);
+
+static pthread_once_t umask_once = PTHREAD_ONCE_INIT;
+static mode_t newmode;		/* Mode of a new file, see _umask */
+
+/*
+ * Writes the text of (buffer) to (path). With EBN_CRLF in (flags)
+ * every LF not already preceded by a CR is written as CRLF. The file is
+ * replaced as described at eb_savebegin.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int
+ebwrite(TxtBuffer *buffer, const char *path, int flags)
+{
+	TxtBlock *np;
+	char real[PATH_MAX], tmp[PATH_MAX], *text;
+	size_t save;
+	FILE *fp;
+	int error, cr;
+
+	if ((fp = eb_savebegin(path, real, tmp)) == NULL)
+		return -1;
+
+	save = ebtell(buffer);
+	ebseek(buffer, 0);
+
+	error = 0;
+	cr = 0;
+	for (np = buffer->root; np != NULL && !error; np = np->next) {
+		text = EBTEXT(buffer, np);
+		if (flags & EBN_CRLF)
+			error = _writecrlf(fp, text, np->len, &cr);
+		else
+			error = fwrite(text, 1, np->len, fp) != np->len;
+	}
+
+	ebseek(buffer, save);
+
+	return eb_saveend(fp, real, tmp, error);
+}
+
+/*
+ * Starts replacing the file at (path). The new contents are written to
+ * a new temporary file next to the file and renamed over it by
+ * eb_saveend, so the file is either the old or the new contents. If
+ * (path) is a symbolic link, the file it points to is replaced. The
+ * file keeps its permissions, and a new file gets the ones fopen would
+ * give it with the umask the process had at its first save of a new
+ * file. The file to replace and the temporary file are stored to
+ * (real) and (tmp), which have room for PATH_MAX bytes.
+ *
+ * Returns the temporary file or NULL on error.
+ */
+FILE *
+eb_savebegin(const char *path, char *real, char *tmp)
+{
+	struct stat st;
+	mode_t mode;
+	FILE *fp;
+	int fd;
+
+	if (realpath(path, real) == NULL) {
+		if (errno != ENOENT)
+			return NULL;
+		if (snprintf(real, PATH_MAX, "%s", path) >= PATH_MAX) {
+			errno = ENAMETOOLONG;
+			return NULL;
+		}
+	}
+	if (snprintf(tmp, PATH_MAX, "%s.XXXXXX", real) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	if (stat(real, &st) == 0)
+		mode = st.st_mode & 07777;
+	else {
+		pthread_once(&umask_once, _umask);
+		mode = newmode;
+	}
+
+	if ((fd = mkstemp(tmp)) == -1)
+		return NULL;
+	if (fchmod(fd, mode) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		return NULL;
+	}
+
+	return fp;
+}
+
+/*
+ * Finishes a save started with eb_savebegin. The temporary file (tmp)
+ * written through (fp) is synced and renamed over (real), unless
+ * (error) is non-zero or that fails, in which case it is removed.
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int
+eb_saveend(FILE *fp, const char *real, const char *tmp, int error)
+{
+	int saved;
+
+	error = error || fflush(fp) != 0 || fsync(fileno(fp)) == -1;
+	if (fclose(fp) != 0 || error || rename(tmp, real) == -1) {
+		saved = errno;
+		unlink(tmp);
+		errno = saved;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes (len) bytes of (s) to (fp) with CRLF line endings. (cr) tells
+ * whether the byte before (s) was a CR and is updated for the next call.
+ *
+ * Returns non-zero on error.
+ */
+static int
+_writecrlf(FILE *fp, const char *s, size_t len, int *cr)
+{
+	const char *p, *end;
+	size_t n;
+
+	for (end = s + len; s < end; s = p + 1) {
+		if ((p = memchr(s, '\n', end - s)) == NULL) {
+			n = end - s;
+			if (fwrite(s, 1, n, fp) != n)
+				return 1;
+			*cr = s[n - 1] == '\r';
+			return 0;
+		}
+		n = p - s;
+		if (fwrite(s, 1, n, fp) != n)
+			return 1;
+		if (!(n > 0 ? p[-1] == '\r' : *cr) && fputc('\r', fp) == EOF)
+			return 1;
+		if (fputc('\n', fp) == EOF)
+			return 1;
+		*cr = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the umask for the mode of new files. Reading it means setting
+ * it, so this is done only once, at the first save of a new file.
+ */
+static void
+_umask(void)
+{
+	mode_t mask;
+
+	mask = umask(0);
+	umask(mask);
+	newmode = 0666 & ~mask;
+}
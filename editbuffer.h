@@ -40,6 +40,22 @@
 
 typedef struct txt_block TxtBlock;
 typedef struct editbuffer TxtBuffer;
+typedef struct txt_swap TxtSwap;
+typedef struct txt_edit TxtEdit;
+typedef struct txt_change TxtChange;
+typedef struct txt_changes TxtChanges;
+typedef struct txt_columns TxtColumns;
+typedef struct txt_rows TxtRows;
+typedef struct txt_syntax TxtSyntax;
+typedef struct txt_load TxtLoad;
+typedef struct txt_norm TxtNorm;
+typedef struct txt_shared TxtShared;
+typedef struct txt_dedup TxtDedup;
+typedef struct txt_hunk TxtHunk;
+typedef struct txt_words TxtWords;
+typedef struct txt_word TxtWord;
+typedef struct txt_regex TxtRegex;
+typedef struct txt_match TxtMatch;
 
 #if 1
 #define TXTBLOCK_MAXLEN	(2048)	/* Needs to be dividable by 2 */
@@ -50,6 +66,25 @@ typedef struct editbuffer TxtBuffer;
 #define TXTBLOCK_ALLOC	\
 	(TXTBLOCK_MAXLEN) * sizeof(char)
 
+#define TXTBUFFER_INLINE	(128)	/* Text stored within TxtBuffer */
+
+struct txt_block {
+	size_t blockno;		/* Debug aid */
+	size_t len;		/* Finding and splitting */
+	TxtBlock *prev, *next;	/* Insertions in the middle */
+	char *text;		/* Preallocated and not grown */
+	TxtBlock *lprev, *lnext;	/* Resident blocks in LRU order */
+	char *ztext;		/* Compressed text when text is NULL */
+	size_t zlen;		/* Length of compressed or swapped text */
+	size_t slot;		/* Swap file slot */
+	TxtShared *shared;	/* Shared text, see ebdedup.c */
+	size_t rows;		/* Visual rows, see ebscrollrows */
+	unsigned int rscol;	/* Column at the start when laid out */
+	unsigned int recol;	/* Column at the end when laid out */
+	unsigned int rwidth;	/* Wrap width when laid out */
+	int flags;
+};
+
 struct editbuffer {
 	size_t alloc;		/* Debug aid */
 	size_t blocks;		/* Debug aid */
@@ -58,8 +93,36 @@ struct editbuffer {
 	size_t offset;		/* Offset within the node */
 	TxtBlock *root;		/* Current node */
 	TxtBlock *last;		/* Used when root is NULL */
+	TxtBlock *mru;		/* Most recently used resident block */
+	TxtBlock *lru;		/* Least recently used resident block */
+	size_t resident;	/* Resident blocks in the LRU */
+	size_t maxresident;	/* Evict beyond this, 0 disables */
+	size_t zblocks;		/* Resident limit set by ebcompress */
+	TxtSwap *swap;		/* Swap file, see ebswap.c */
+	size_t version;		/* Bumped by every edit */
+	TxtChanges *changes;	/* Change log, see ebchange.c */
+	void (*onchange)(TxtBuffer *, TxtChange *, void *);
+	void *onchangearg;
+	TxtColumns *columns;	/* Column checkpoints, see ebcol.c */
+	TxtRows *rows;		/* Row index, see ebscroll.c */
+	size_t shape;		/* Bumped when blocks are added or removed */
+	TxtSyntax *syntax;	/* Lexer checkpoints, see ebsyntax.c */
+	TxtLoad *load;		/* Background load, see ebload.c */
+	TxtWords *words;	/* Word index, see ebword.c */
+	int dedup;		/* Share full blocks, see ebdedup.c */
+	char *image;		/* Mapped session image, see ebimage.c */
+	size_t imagelen;
+	TxtBlock small;		/* First block of a small buffer */
+	char smalltext[TXTBUFFER_INLINE];
 };
 
+/*
+ * A buffer starts with its text stored inline in TxtBuffer and only
+ * allocates blocks once that overflows. Hence TxtBuffer must not be
+ * copied or moved.
+ */
+#define EBINLINE(b, x)	((x)->text == (b)->smalltext)
+
 #define LOCAL_OFFSET(x)	((x)->offset - (x)->root_offset)
 
 /* XXX: We could perhaps have ebtell(x) (x)->offset !!! :) */
@@ -70,39 +133,213 @@ struct editbuffer {
 #define ebtell(x) (x)->offset
 #endif
 
-struct txt_block {
-	size_t blockno;		/* Debug aid */
-	size_t len;		/* Finding and splitting */
-	TxtBlock *prev, *next;	/* Insertions in the middle */
-	char *text;		/* Preallocated and not grown */
+#define ebversion(x) (x)->version
+#define ebusage(x) (x)->alloc
+
+#define EBF_SWAPPED	0x01	/* Text is in the swap file */
+#define EBF_RAW		0x02	/* Evicted text is not compressed */
+#define EBF_LAYOUT	0x04	/* Visual rows are known */
+#define EBF_LAYOUTNL	0x08	/* Block has a newline */
+#define EBF_MAPPED	0x10	/* Text is in the session image */
+#define EBF_ASCII	0x20	/* Text is all ASCII, if EBF_SCANNED */
+#define EBF_SCANNED	0x40	/* EBF_ASCII is known, see eb_ascii */
+#define EBF_SHARED	0x80	/* Text is shared with other blocks */
+#define EBF_LAYOUTPEEK	0x100	/* Layout looked at the neighbours */
+
+/* Text does not belong to the block and is copied before writing */
+#define EBF_BORROWED	(EBF_MAPPED | EBF_SHARED)
+
+/*
+ * Marks cached per-block information stale after modifying the text
+ * or length of block (x), including the layout of its neighbours if
+ * it depended on the edges of (x).
+ */
+#define EBMODIFIED(x)	do {						\
+	(x)->flags &= ~(EBF_LAYOUT | EBF_SCANNED | EBF_ASCII);		\
+	if ((x)->prev != NULL)						\
+		EBRELINKED((x)->prev);					\
+	if ((x)->next != NULL)						\
+		EBRELINKED((x)->next);					\
+} while (0)
+
+/*
+ * Marks the layout of block (x) stale after linking it next to another
+ * block, if the layout depended on the neighbours.
+ */
+#define EBRELINKED(x)	\
+	((x)->flags &= ((x)->flags & EBF_LAYOUTPEEK) ? ~EBF_LAYOUT : ~0)
+
+/*
+ * Non-zero if the text of block (x) is all ASCII.
+ */
+#define EBASCII(b, x)	(((x)->flags & EBF_SCANNED) ? \
+	((x)->flags & EBF_ASCII) : eb_ascii((b), (x)))
+
+#define EB_TABSTOP	8
+
+/*
+ * Replaces (len) bytes at (off) with (slen) bytes from (s), see ebapply.
+ */
+struct txt_edit {
+	size_t off;
+	size_t len;
+	char *s;
+	size_t slen;
 };
 
-int     ebseek(TxtBuffer *buffer, size_t offset);
+/*
+ * Tells that (newlen) bytes at (off) replaced (oldlen) bytes, which
+ * changed the number of lines by (lines), see ebchanges.
+ */
+struct txt_change {
+	size_t off;
+	size_t oldlen;
+	size_t newlen;
+	ssize_t lines;
+};
+
+/*
+ * Tells that (blen) bytes at (boff) of one buffer replace (alen) bytes
+ * at (aoff) of another, see ebdiff.
+ */
+struct txt_hunk {
+	size_t aoff;
+	size_t alen;
+	size_t boff;
+	size_t blen;
+};
+
+/*
+ * Word found by ebcomplete.
+ */
+struct txt_word {
+	const char *s;		/* NUL terminated */
+	size_t len;
+	size_t count;		/* Roughly how often it occurs */
+};
+
+/*
+ * Match found by ebregall.
+ */
+struct txt_match {
+	size_t off;
+	size_t len;
+};
+
+#define EBR_ICASE	0x01	/* Letters match either case */
+
+/*
+ * Line endings and encoding found by ebnormalize.
+ */
+struct txt_norm {
+	size_t lf;		/* Lines ending with a LF only */
+	size_t crlf;		/* Lines ending with a CRLF */
+	size_t invalid;		/* Invalid UTF-8 sequences */
+	size_t badoff;		/* First of them, or length if none */
+};
+
+#define EBN_LF		0x01	/* Convert CRLF to LF */
+#define EBN_CRLF	0x02	/* Write LF as CRLF */
+
+/*
+ * Text shared by ebdedup, for all buffers together.
+ */
+struct txt_dedup {
+	size_t hits;		/* Blocks found to be duplicates */
+	size_t shared;		/* Distinct texts shared */
+	size_t refs;		/* Blocks sharing them */
+	size_t saved;		/* Bytes not allocated thanks to sharing */
+};
+
+#define EB_MINRESIDENT	4	/* Blocks an edit may touch at once */
+
+/*
+ * Text of a block that may have been compressed. Always access block
+ * text through this.
+ */
+#define EBTEXT(b, x)	((x) == (b)->mru ? (x)->text : eb_text((b), (x)))
+
+/*
+ * Text of a block for modifying it. Always use this instead of EBTEXT()
+ * before writing to the text.
+ */
+#define EBWTEXT(b, x)	\
+	(((x)->flags & EBF_BORROWED) ? eb_wtext((b), (x)) : EBTEXT((b), (x)))
+
+size_t  ebseek(TxtBuffer *buffer, size_t offset);
 int     ebget (TxtBuffer *buffer);
-void    ebput (TxtBuffer *buffer, char *s, size_t len);
-void	ebdel (TxtBuffer *buffer, size_t len);
+int     ebrget(TxtBuffer *buffer);
+size_t  ebspan(TxtBuffer *buffer, size_t off, char **p);
+size_t  ebrspan(TxtBuffer *buffer, size_t end, char **p);
+ssize_t ebput (TxtBuffer *buffer, char *s, size_t len);
+int	ebdel (TxtBuffer *buffer, size_t len);
 void    ebdump(TxtBuffer *buffer);
+void    ebclose(TxtBuffer *buffer);
+void    ebcompress(TxtBuffer *buffer, size_t nblocks);
+int     ebswap(TxtBuffer *buffer, size_t budget, const char *dir);
+int     ebapply(TxtBuffer *buffer, TxtEdit *edits, size_t n);
+int     ebsplice(TxtBuffer *dst, size_t dst_off, TxtBuffer *src,
+            size_t src_off, size_t len);
+int     ebsave(TxtBuffer *buffer, const char *path);
+int     ebrestore(TxtBuffer *buffer, const char *path);
+int     ebwrite(TxtBuffer *buffer, const char *path, int flags);
+void    ebnormalize(TxtBuffer *buffer, int flags, TxtNorm *norm);
+void    ebdedup(TxtBuffer *buffer, int enable);
+void    ebdedupstats(TxtDedup *stats);
+int     ebload_async(TxtBuffer *buffer, const char *path);
+int     ebloadpoll(TxtBuffer *buffer, int wait);
+int     ebloadprogress(TxtBuffer *buffer, size_t *loaded, size_t *total);
+void    ebloadcancel(TxtBuffer *buffer);
+ssize_t ebchanges(TxtBuffer *buffer, size_t since, TxtChange *out, size_t n);
+void    ebonchange(TxtBuffer *buffer,
+            void (*fn)(TxtBuffer *, TxtChange *, void *), void *arg);
+ssize_t ebdiff(TxtBuffer *a, TxtBuffer *b, TxtHunk *out, size_t n);
+void    ebarena(size_t budget);
+size_t  ebarenaused(void);
+void    ebonreclaim(int (*fn)(TxtBuffer *, size_t, void *), void *arg);
 
 #if 0
 size_t  ebtell(TxtBuffer *);
 #endif
 
-int     ebfind(TxtBuffer *b, char c, int i, int incr);
+ssize_t ebfind(TxtBuffer *b, char c, ssize_t i, int incr);
+
+TxtRegex *ebregcomp(const char *pattern, int flags);
+void    ebregfree(TxtRegex *re);
+ssize_t ebregfind(TxtBuffer *b, TxtRegex *re, size_t off, int incr,
+            size_t *len);
+size_t  ebregall(TxtBuffer *b, TxtRegex *re, size_t off, TxtMatch *out,
+            size_t n);
 
 /* Helpers */
-int     ebfindprev(TxtBuffer *eb, int cursor);
-int     ebfindnext(TxtBuffer *eb, int cursor);
-int     ebfindbol(TxtBuffer *eb, int cursor);
-int     ebfindeol(TxtBuffer *eb, int cursor);
-int     ebfindcol(TxtBuffer *b, int i);
-int     ebfindxy(TxtBuffer *b, int x, int y, int pos);
-void    ebfindxydelta(TxtBuffer *b, int p1, int p2, int *x, int *y);
+ssize_t ebfindprev(TxtBuffer *eb, ssize_t cursor);
+ssize_t ebfindnext(TxtBuffer *eb, ssize_t cursor);
+ssize_t ebfindbol(TxtBuffer *eb, ssize_t cursor);
+ssize_t ebfindeol(TxtBuffer *eb, ssize_t cursor);
+size_t  ebfindcol(TxtBuffer *b, size_t i);
+size_t  ebfindxy(TxtBuffer *b, size_t x, size_t y, size_t pos);
+void    ebfindxydelta(TxtBuffer *b, size_t p1, size_t p2, size_t *x,
+            size_t *y);
+
+char   *ebwordat(TxtBuffer *b, size_t i);
+size_t  ebwordat_r(TxtBuffer *b, size_t i, char *word, size_t size);
+void    ebwordchars(TxtBuffer *b, const char *set);
+size_t  ebcomplete(TxtBuffer *b, const char *prefix, size_t len,
+            TxtWord *out, size_t n);
 
-char *ebwordat(TxtBuffer *b, int i);
+size_t  ebscroll(TxtBuffer *b, size_t pos, ssize_t n);
+size_t  ebscrollrows(TxtBuffer *b, size_t pos, ssize_t n, size_t width);
 
-int     ebscroll(TxtBuffer *b, int pos, int n);
+size_t  ebcolumn(TxtBuffer *b, size_t pos);
+size_t  ebcolpos(TxtBuffer *b, size_t pos, size_t col);
+
+void    ebsyntax(TxtBuffer *b, size_t statelen, size_t interval);
+ssize_t ebsyntaxdamage(TxtBuffer *b);
+size_t  ebsyntaxresume(TxtBuffer *b, size_t pos, void *state);
+int     ebsyntaxmark(TxtBuffer *b, size_t off, const void *state);
 
 ssize_t ebslice(TxtBuffer *, char *, size_t, char *, size_t);
+size_t  ebgetline(TxtBuffer *buffer, char **linep, char *s, size_t len);
 
 /*
 ssize_t ebread(TxtBuffer *buffer, char *s, size_t len);
@@ -111,6 +348,74 @@ ssize_t ebread(TxtBuffer *buffer, char *s, size_t len);
 /* ucs2.c */
 int     editbuffer_get_ucs2   (struct editbuffer *);
 int     editbuffer_del_ucs2   (struct editbuffer *, ssize_t);
-int     editbuffer_seek_ucs2  (struct editbuffer *, ssize_t);
+size_t  editbuffer_seek_ucs2  (struct editbuffer *, ssize_t);
+
+/* ebblock.c: internal */
+TxtBlock *eb_newblock(TxtBuffer *, TxtBlock *);
+TxtBlock *eb_allocblock(TxtBuffer *);
+TxtBlock *eb_cut(TxtBuffer *, size_t);
+TxtBlock *eb_first(TxtBuffer *);
+void    eb_freeblock(TxtBuffer *, TxtBlock *);
+size_t  eb_blockno(void);
+
+/* ebchange.c: internal */
+void    eb_changed(TxtBuffer *, size_t, size_t, size_t, ssize_t);
+size_t  eb_nlines(TxtBuffer *, size_t, size_t);
+
+/* ebcol.c: internal */
+void    eb_colchanged(TxtBuffer *, size_t, size_t, size_t, ssize_t);
+void    eb_colfree(TxtBuffer *);
+size_t  eb_colwidth(unsigned int, size_t);
+
+/* ebscroll.c: internal */
+void    eb_rowchanged(TxtBuffer *, size_t, size_t, size_t);
+void    eb_rowfree(TxtBuffer *);
+
+/* ebsyntax.c: internal */
+void    eb_syntaxchanged(TxtBuffer *, size_t, size_t, size_t);
+void    eb_syntaxfree(TxtBuffer *);
+
+/* ebword.c: internal */
+void    eb_wordchanged(TxtBuffer *, size_t, size_t, size_t);
+void    eb_wordfree(TxtBuffer *);
+
+/* ebwrite.c: internal */
+FILE   *eb_savebegin(const char *, char *, char *);
+int     eb_saveend(FILE *, const char *, const char *, int);
+
+/* ebnorm.c: internal */
+int     eb_ascii(TxtBuffer *, TxtBlock *);
+
+/* ebdedup.c: internal */
+void    eb_dedup(TxtBuffer *, TxtBlock *);
+void    eb_unshare(TxtShared *);
+
+/* ebload.c: internal */
+void    eb_loadchanged(TxtBuffer *, size_t, size_t, size_t);
+
+/* ebarena.c: internal */
+int     eb_reserve(TxtBuffer *, size_t);
+char   *eb_alloctext(TxtBuffer *);
+void    eb_freetext(TxtBuffer *, char *);
+void    eb_movetext(TxtBuffer *, TxtBuffer *, char *);
+
+/* ebcache.c: internal */
+char   *eb_text(TxtBuffer *, TxtBlock *);
+char   *eb_wtext(TxtBuffer *, TxtBlock *);
+void    eb_release(TxtBuffer *, TxtBlock *);
+void    eb_recache(TxtBuffer *);
+void    eb_adopt(TxtBuffer *, TxtBuffer *, TxtBlock *);
+void    eb_forget(TxtBuffer *, TxtBlock *);
+
+/* ebswap.c: internal */
+size_t  eb_swaplimit(TxtBuffer *);
+void    eb_swapout(TxtBuffer *, TxtBlock *, char *, size_t);
+void    eb_swapin(TxtBuffer *, TxtBlock *, char *);
+void    eb_swapfree(TxtBuffer *, TxtBlock *);
+
+/* lz.c */
+#define LZ_BOUND(n)	((n) + (n) / 255 + 16)
+size_t  lz_compress(const char *, size_t, char *, size_t);
+size_t  lz_decompress(const char *, size_t, char *, size_t);
 
 #endif
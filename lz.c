@@ -0,0 +1,196 @@
+/*
+ * editbuffer - editable buffer container with standard I/O semantics
+ * Copyright (c) 2020-2021, Tommi Leino <namhas@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Small LZ77 codec for compressing cold text blocks. The format is a
+ * sequence of tokens where the high nibble is the literal count and the
+ * low nibble is the match length minus LZ_MINMATCH. A nibble of 15 is
+ * extended with bytes that are summed until a byte less than 255. The
+ * literals follow the token and a two-byte little-endian match offset
+ * follows the literals, except for the last token which has only
+ * literals.
+ *
+ * The format is only ever used within a single process and is tuned
+ * for block sized inputs, not for general purpose use.
+ */
+
+#include "editbuffer.h"
+#include <stdint.h>
+
+#define LZ_MINMATCH	4
+#define LZ_HASHBITS	12
+#define LZ_MAXOFFSET	65535
+
+static uint32_t	_read32(const unsigned char *);
+static size_t	_putlen(unsigned char *, size_t, size_t, size_t);
+
+static uint32_t
+_read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/*
+ * Writes the extension bytes of a length (n) that did not fit into
+ * its nibble to dst at offset (o), up to (cap). Returns the new offset
+ * or cap + 1 on overflow.
+ */
+static size_t
+_putlen(unsigned char *dst, size_t o, size_t cap, size_t n)
+{
+	for (; n >= 255; n -= 255) {
+		if (o >= cap)
+			return cap + 1;
+		dst[o++] = 255;
+	}
+	if (o >= cap)
+		return cap + 1;
+	dst[o++] = (unsigned char) n;
+	return o;
+}
+
+/*
+ * Compresses (len) bytes from (src) into (dst) which has room for
+ * (cap) bytes. Returns the compressed length or 0 if the result did
+ * not fit; LZ_BOUND(len) bytes are always enough.
+ */
+size_t
+lz_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	unsigned char *d = (unsigned char *) dst;
+	uint32_t ht[1 << LZ_HASHBITS];
+	size_t ip, anchor, ref, o, tok, nlit, mlen;
+	uint32_t h;
+
+	memset(ht, 0, sizeof(ht));
+	ip = anchor = o = 0;
+
+	while (ip + LZ_MINMATCH <= len) {
+		h = (_read32(&s[ip]) * 2654435761U) >> (32 - LZ_HASHBITS);
+		ref = ht[h];
+		ht[h] = ip + 1;
+		if (ref == 0 || ip - (ref - 1) > LZ_MAXOFFSET ||
+		    _read32(&s[ref - 1]) != _read32(&s[ip])) {
+			ip++;
+			continue;
+		}
+		ref--;
+
+		mlen = LZ_MINMATCH;
+		while (ip + mlen < len && s[ref + mlen] == s[ip + mlen])
+			mlen++;
+
+		nlit = ip - anchor;
+		if ((tok = o++) >= cap)
+			return 0;
+		d[tok] = (nlit < 15 ? nlit : 15) << 4;
+		if (nlit >= 15 && (o = _putlen(d, o, cap, nlit - 15)) > cap)
+			return 0;
+		if (o + nlit + 2 > cap)
+			return 0;
+		memcpy(&d[o], &s[anchor], nlit);
+		o += nlit;
+		d[o++] = (ip - ref) & 0xff;
+		d[o++] = (ip - ref) >> 8;
+
+		d[tok] |= (mlen - LZ_MINMATCH < 15 ? mlen - LZ_MINMATCH : 15);
+		if (mlen - LZ_MINMATCH >= 15 &&
+		    (o = _putlen(d, o, cap, mlen - LZ_MINMATCH - 15)) > cap)
+			return 0;
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	nlit = len - anchor;
+	if ((tok = o++) >= cap)
+		return 0;
+	d[tok] = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15 && (o = _putlen(d, o, cap, nlit - 15)) > cap)
+		return 0;
+	if (o + nlit > cap)
+		return 0;
+	memcpy(&d[o], &s[anchor], nlit);
+	o += nlit;
+
+	return o;
+}
+
+/*
+ * Decompresses (zlen) bytes from (src) into (dst) which has room for
+ * (cap) bytes. Returns the decompressed length or (size_t) -1 if the
+ * input is corrupt or does not fit.
+ */
+size_t
+lz_decompress(const char *src, size_t zlen, char *dst, size_t cap)
+{
+	const unsigned char *s = (const unsigned char *) src;
+	unsigned char *d = (unsigned char *) dst;
+	size_t ip, op, n, off;
+	unsigned char tok, b;
+
+	ip = op = 0;
+	while (ip < zlen) {
+		tok = s[ip++];
+
+		n = tok >> 4;
+		if (n == 15) {
+			do {
+				if (ip >= zlen)
+					return (size_t) -1;
+				b = s[ip++];
+				n += b;
+			} while (b == 255);
+		}
+		if (ip + n > zlen || op + n > cap)
+			return (size_t) -1;
+		memcpy(&d[op], &s[ip], n);
+		ip += n;
+		op += n;
+
+		if (ip == zlen)
+			break;	/* Last token has only literals */
+
+		if (ip + 2 > zlen)
+			return (size_t) -1;
+		off = s[ip] | (s[ip + 1] << 8);
+		ip += 2;
+
+		n = (tok & 15);
+		if (n == 15) {
+			do {
+				if (ip >= zlen)
+					return (size_t) -1;
+				b = s[ip++];
+				n += b;
+			} while (b == 255);
+		}
+		n += LZ_MINMATCH;
+		if (off == 0 || off > op || op + n > cap)
+			return (size_t) -1;
+
+		/* Byte at a time because the match may overlap */
+		for (; n > 0; n--, op++)
+			d[op] = d[op - off];
+	}
+
+	return op;
+}
@@ -40,9 +40,16 @@
 int
 editbuffer_get_ucs2(struct editbuffer *b)
 {
-	int ch, nbytes, cursor, u;
+	size_t cursor;
+	int ch, nbytes, u;
+
+	/* Every byte of ASCII text is a character */
+	if (b->root != NULL && LOCAL_OFFSET(b) < b->root->len &&
+	    EBASCII(b, b->root))
+		return ebget(b);
 
 	cursor = ebtell(b);
+	u = 0;
 	/* We iterate maximum of 4 bytes */
 	for (nbytes = 3; nbytes >= 0; nbytes--) {
 		ch = ebget(b);
@@ -76,7 +83,7 @@ editbuffer_get_ucs2(struct editbuffer *b)
 			 */
 			nbytes = 0;
 			u = ch;
-		} else if (ch >= 0x80 && ch < 0xC0) {
+		} else if (ch >= 0x80 && ch < 0xC0 && nbytes < 3) {
 			/*
 			 * We're on continuation.
 			 */
@@ -103,8 +110,12 @@ editbuffer_del_ucs2(struct editbuffer *b, ssize_t n)
 }
 #endif
 
-static int ucs2_seek_decr(struct editbuffer *, ssize_t);
-static int ucs2_seek_incr(struct editbuffer *, ssize_t);
+static size_t ucs2_seek_decr(struct editbuffer *, ssize_t);
+static size_t ucs2_seek_incr(struct editbuffer *, ssize_t);
+static size_t ucs2_seqlen(const char *, size_t, size_t);
+static size_t ucs2_decr(struct editbuffer *, size_t);
+
+#define ISCONT(c)	(((c) & 0xC0) == 0x80)
 
 /*
  * Changes the given editbuffer index by xchar2b units to either
@@ -112,7 +123,7 @@ static int ucs2_seek_incr(struct editbuffer *, ssize_t);
  *
  * Returns the new index in editbuffer units.
  */
-int
+size_t
 editbuffer_seek_ucs2(struct editbuffer *b, ssize_t n)
 {
 	if (n < 0)
@@ -123,68 +134,173 @@ editbuffer_seek_ucs2(struct editbuffer *b, ssize_t n)
 
 /*
  * Decreases index in a UTF-8 encoded buffer one UTF-8 byte sequence
- * at a time.
+ * at a time, walking the text a block at a time.
  *
  * Returns the new cursor position.
  */
-static int
+static size_t
 ucs2_seek_decr(struct editbuffer *b, ssize_t n)
 {
-	int cursor, begin, ch, i;
+	size_t cursor, start, i, j, k, len;
+	char *text;
 
 	cursor = ebtell(b);
-	while (n-- && cursor > 0) {
-		begin = ebtell(b);
-		ebseek(b, --cursor);
-		ch = ebget(b);
-		/*
-		 * We cannot actually begin from a start byte when
-		 * we're travelling backwards. Count as one character.
-		 */
-		if (ch >= 0xC0)
+	while (n > 0 && (k = ebrspan(b, cursor, &text)) > 0) {
+		/* Every byte of ASCII text is a character */
+		if (EBASCII(b, b->root)) {
+			if (k > n)
+				k = n;
+			cursor -= k;
+			n -= k;
 			continue;
-		/*
-		 * We continue decreasing until we're on first byte
-		 * in the multibyte sequence which means we're not
-		 * on a UTF-8 continuation byte. However, we honor
-		 * the maximum of 3 continuation bytes in UTF-8 spec.
-		 *
-		 * Continue bytes: >= 0b10xxxxxx (0x80).
-		 * Start bytes:    >= 0b110xxxxx (0xC0).
-		 */
-		i = 3;
-		while (i-- && ch >= 0x80 && ch < 0xC0 && cursor > 0) {
-			ebseek(b, --cursor);
-			ch = ebget(b);
 		}
 
-		/*
-		 * Check if forward parsing does not match with our
-		 * reverse iteration, if so, trust the forward parsing,
-		 * but only do this in case we actually parsed some
-		 * UTF-8.
-		 */
-		if (i != 3) {
-			ebseek(b, cursor);
-			editbuffer_get_ucs2(b);
-			if (ebtell(b) != begin)
-				cursor = ebtell(b);
+		start = cursor - k;
+		for (; k > 0 && n > 0; n--) {
+			/*
+			 * We cannot actually begin from a start byte when
+			 * we're travelling backwards. Count as one
+			 * character, like ASCII.
+			 */
+			if (!ISCONT(text[k - 1])) {
+				k--;
+				continue;
+			}
+
+			/*
+			 * Back to the first byte of the sequence, but no
+			 * more than the 3 continuation bytes of the UTF-8
+			 * spec, and then trust forward parsing.
+			 */
+			for (i = 0, j = k - 1; i < 3 && j > 0 && ISCONT(text[j]);
+			    i++)
+				j--;
+			if (j == 0 && i < 3 && ISCONT(text[j]) && start > 0)
+				break;
+			if ((len = ucs2_seqlen(text, j, k)) == 0)
+				break;
+			k = j + len != k ? j + len : j;
+		}
+		cursor = start + k;
+
+		/* A sequence that continues in the previous block */
+		if (k > 0 && n > 0) {
+			cursor = ucs2_decr(b, cursor);
+			n--;
 		}
 	}
 
-	return ebseek(b, cursor);	/* Undo effect of get */
+	return ebseek(b, cursor);
 }
 
 /*
- * Increases index in a UTF-8 encoded buffer one UCS2 code at a time.
+ * Decreases (cursor) by one UTF-8 byte sequence that starts with a
+ * continuation byte.
  *
  * Returns the new cursor position.
  */
-static int
+static size_t
+ucs2_decr(struct editbuffer *b, size_t cursor)
+{
+	size_t begin;
+	int ch, i;
+
+	begin = cursor;
+	ebseek(b, cursor);
+	ch = ebrget(b);
+	cursor--;
+
+	/*
+	 * We continue decreasing until we're on first byte
+	 * in the multibyte sequence which means we're not
+	 * on a UTF-8 continuation byte. However, we honor
+	 * the maximum of 3 continuation bytes in UTF-8 spec.
+	 *
+	 * Continue bytes: >= 0b10xxxxxx (0x80).
+	 * Start bytes:    >= 0b110xxxxx (0xC0).
+	 */
+	i = 3;
+	while (i-- && ch >= 0x80 && ch < 0xC0 && cursor > 0) {
+		ch = ebrget(b);
+		cursor--;
+	}
+
+	/*
+	 * Check if forward parsing does not match with our
+	 * reverse iteration, if so, trust the forward parsing.
+	 */
+	ebseek(b, cursor);
+	editbuffer_get_ucs2(b);
+	if (ebtell(b) != begin)
+		cursor = ebtell(b);
+
+	return cursor;
+}
+
+/*
+ * Increases index in a UTF-8 encoded buffer one UCS2 code at a time,
+ * walking the text a block at a time.
+ *
+ * Returns the new cursor position.
+ */
+static size_t
 ucs2_seek_incr(struct editbuffer *b, ssize_t n)
 {
-	while (n-- && editbuffer_get_ucs2(b) != EOF)
-		;
+	size_t cursor, i, k, len;
+	char *text;
+
+	cursor = ebtell(b);
+	while (n > 0 && (k = ebspan(b, cursor, &text)) > 0) {
+		/* Every byte of ASCII text is a character */
+		if (EBASCII(b, b->root)) {
+			if (k > n)
+				k = n;
+			cursor += k;
+			n -= k;
+			continue;
+		}
+
+		for (i = 0; i < k && n > 0; n--) {
+			if ((unsigned char) text[i] < 0x80)
+				len = 1;
+			else if ((len = ucs2_seqlen(text, i, k)) == 0)
+				break;
+			i += len;
+		}
+		cursor += i;
+
+		/* A sequence that continues in the next block */
+		if (i < k && n > 0) {
+			ebseek(b, cursor);
+			editbuffer_get_ucs2(b);
+			cursor = ebtell(b);
+			n--;
+		}
+	}
+
+	return ebseek(b, cursor);
+}
+
+/*
+ * Returns how many bytes editbuffer_get_ucs2() takes for the character
+ * at (i) of (text) of (k) bytes, or 0 if that depends on what follows.
+ */
+static size_t
+ucs2_seqlen(const char *text, size_t i, size_t k)
+{
+	size_t j, len;
+	int ch;
+
+	ch = (unsigned char) text[i];
+	if (ch < 0xC2 || ch >= 0xF5)
+		return 1;	/* ASCII or error */
+
+	len = ch >= 0xF0 ? 4 : ch >= 0xE0 ? 3 : 2;
+	if (i + len > k)
+		return 0;
+	for (j = 1; j < len; j++)
+		if (!ISCONT(text[i + j]))
+			return 1;
 
-	return ebtell(b);
+	return len;
 }